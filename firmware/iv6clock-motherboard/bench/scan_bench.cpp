@@ -0,0 +1,95 @@
+/*
+* Shift register backend cycle count comparison.
+*
+* Build and run under simavr:
+*
+*   pio run -e scan_bench
+*   simavr -m atmega328p -f 16000000 .pio/build/scan_bench/firmware.elf
+*
+* Every backend pushes the same 16 bit pattern SCAN_BENCH_RUNS times.
+* Timer1 runs at F_CPU, so the figures are CPU cycles per sr_write() call,
+* including the call overhead. Results are printed to the UART, which
+* simavr echoes to the console.
+*/
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+#include "../src/shift_register.h"
+
+#define SCAN_BENCH_RUNS 64
+
+typedef void (*sr_write_t)(uint8_t byte1, uint8_t byte2);
+
+static uint16_t bench(sr_write_t write)
+{
+    uint32_t total = 0;
+
+    for (uint8_t i = 0; i < SCAN_BENCH_RUNS; i++)
+    {
+        uint8_t sreg = SREG;
+        cli();
+        TCNT1 = 0;
+        write((uint8_t)~i, i);
+        uint16_t cycles = TCNT1;
+        SREG = sreg;
+
+        total += cycles;
+    }
+
+    return total / SCAN_BENCH_RUNS;
+}
+
+static void report(const char *name, uint16_t cycles)
+{
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(cycles);
+    Serial.print(" cycles, ");
+    Serial.print(cycles / (F_CPU / 1000000UL));
+    Serial.println(" us");
+}
+
+void setup()
+{
+    // Timer1 free running at F_CPU
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+
+    // calibrate the TCNT1 read itself
+    uint16_t overhead;
+    {
+        uint8_t sreg = SREG;
+        cli();
+        TCNT1 = 0;
+        overhead = TCNT1;
+        SREG = sreg;
+    }
+
+    sr_init_shiftout();
+    uint16_t shiftout_cycles = bench(sr_write_shiftout) - overhead;
+
+    sr_init_port();
+    uint16_t port_cycles = bench(sr_write_port) - overhead;
+
+    sr_init_usart();
+    uint16_t usart_cycles = bench(sr_write_usart) - overhead;
+
+    // USART0 back to asynchronous mode for the report
+    UCSR0B = 0;
+    Serial.begin(9600);
+
+    report("shiftOut", shiftout_cycles);
+    report("PORTD   ", port_cycles);
+    report("USART   ", usart_cycles);
+    Serial.flush();
+
+    // stops simavr
+    cli();
+    sleep_enable();
+    sleep_cpu();
+}
+
+void loop()
+{
+}
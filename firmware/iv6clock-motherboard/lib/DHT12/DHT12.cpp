@@ -2,31 +2,58 @@
 
 #define DHT12_ADDRESS  ((uint8_t)0x5C)
 
-#ifdef ESP8266
-void DHT12::begin(uint8_t sda, uint8_t scl) {
-  Wire.begin(sda, scl);
-}
-#endif
-
 void DHT12::begin() {
-  Wire.begin();
+  twi_queue_init();
 }
 
-int8_t DHT12::read() {
-  /*
-    READ SENSOR
-  */
-  int status = readSensor();
-  if (status < 0) {
-    return status;
+bool DHT12::requestRead(void (*callback)(int8_t status)) {
+  if (transaction.status == TWI_STATUS_PENDING) {
+    return false;
   }
+
   /*
-    CONVERT AND STORE
+    REGISTER 0, THEN 5 BYTES
   */
-  humidity = bits[0] + bits[1] * 0.1;
-  temperature = (bits[2] & 0x7F) + bits[3] * 0.1;
-  if (bits[2] & 0x80) {
-    temperature = -temperature;
+  reg = 0;
+  transaction.address = DHT12_ADDRESS;
+  transaction.tx = &reg;
+  transaction.tx_len = 1;
+  transaction.rx = bits;
+  transaction.rx_len = sizeof(bits);
+  transaction.callback = onTransaction;
+  transaction.context = this;
+
+  this->callback = callback;
+
+  return twi_queue_post(&transaction);
+}
+
+int8_t DHT12::read() {
+  if (!requestRead()) {
+    return DHT12_BUSY;
+  }
+
+  while (transaction.status == TWI_STATUS_PENDING) {
+    twi_queue_poll();
+  }
+  twi_queue_poll();
+
+  return status;
+}
+
+void DHT12::onTransaction(twi_transaction_t *transaction) {
+  DHT12 *sensor = (DHT12 *)transaction->context;
+
+  sensor->status = sensor->convert(transaction->status);
+
+  if (sensor->callback != nullptr) {
+    sensor->callback(sensor->status);
+  }
+}
+
+int8_t DHT12::convert(uint8_t twi_status) {
+  if (twi_status != TWI_STATUS_OK) {
+    return DHT12_ERROR_CONNECT;
   }
 
   /*
@@ -37,40 +64,43 @@ int8_t DHT12::read() {
     return DHT12_ERROR_CHECKSUM;
   }
 
-  return DHT12_OK;
-}
-
-int DHT12::readSensor() {
   /*
-    GET CONNECTION
+    CONVERT AND STORE
+    Integral part, then tenths. Bit 7 of the
+    temperature integral byte is the sign.
   */
-  Wire.beginTransmission(DHT12_ADDRESS);
-  Wire.write(0);
-  int rv = Wire.endTransmission();
-  if (rv < 0) {
-    return rv;
+  humidity = bits[0] * 10 + bits[1];
+  temperature = (bits[2] & 0x7F) * 10 + bits[3];
+  if (bits[2] & 0x80) {
+    temperature = -temperature;
   }
+  data = true;
 
-  /*
-    GET DATA
-  */
-  int bytes = Wire.requestFrom(DHT12_ADDRESS, (uint8_t)5);
-  if (bytes == 0) {
-    return DHT12_ERROR_CONNECT;
-  }
-  if (bytes < (uint8_t)5) {
-    return DHT12_MISSING_BYTES;
-  }
-  for (int i = 0; i < bytes; i++)   {
-    bits[i] = Wire.read();
-  }
-  return bytes;
+  return DHT12_OK;
 }
 
-float DHT12::getHumidity() {
+int8_t DHT12::getStatus() {
+  return status;
+}
+
+bool DHT12::hasData() {
+  return data;
+}
+
+int16_t DHT12::getHumidity10() {
   return humidity;
 }
 
-float DHT12::getTemperature() {
+int16_t DHT12::getTemperature10() {
   return temperature;
-}
\ No newline at end of file
+}
+
+#ifndef DHT12_NO_FLOAT
+float DHT12::getHumidity() {
+  return humidity / 10.0f;
+}
+
+float DHT12::getTemperature() {
+  return temperature / 10.0f;
+}
+#endif
@@ -1,30 +1,60 @@
 #ifndef DHT12_H
 #define DHT12_H
 
-#include <Wire.h>
 #include <Arduino.h>
+#include <TwiQueue.h>
 
 #define DHT12_OK              (int8_t)0
 #define DHT12_ERROR_CHECKSUM  (int8_t)-10
 #define DHT12_ERROR_CONNECT   (int8_t)-11
 #define DHT12_MISSING_BYTES   (int8_t)-12
+#define DHT12_BUSY            (int8_t)-13
+#define DHT12_NO_DATA         (int8_t)-14
+
+/*
+  Values are kept in fixed point, tenths of a degree / percent.
+  Define DHT12_NO_FLOAT to drop the float getters and the soft-float
+  code they pull in.
+
+  The sensor is read through the TwiQueue: requestRead() queues the
+  transaction and returns at once, the values are converted when it
+  completes and the optional callback gets the status. Until the first
+  read succeeds the status is DHT12_NO_DATA and the values are not real,
+  a failed read later keeps the values of the last good one.
+*/
 
 class DHT12 {
   public:
-#ifdef ESP8266
+    DHT12() : status(DHT12_NO_DATA), data(false) {}
     /*
       Init Sensor
     */
-    void begin(uint8_t sda, uint8_t scl);
-#endif
+    void begin();
     /*
-      Init Sensor
+      Queue a sensor read, false if one is still in flight
     */
-    void begin();
+    bool requestRead(void (*callback)(int8_t status) = nullptr);
     /*
-      Read raw data
+      Read raw data, blocks until the transaction completes
     */
     int8_t read();
+    /*
+      Status of the last completed read
+    */
+    int8_t getStatus();
+    /*
+      True once a read succeeded, the values are real from then on
+    */
+    bool hasData();
+    /*
+      Get Humidity, 0.1 %
+    */
+    int16_t getHumidity10();
+    /*
+      Get Temperature, 0.1 C
+    */
+    int16_t getTemperature10();
+#ifndef DHT12_NO_FLOAT
     /*
       Get Humidity
     */
@@ -33,19 +63,24 @@ class DHT12 {
       Get Temperature
     */
     float getTemperature();
+#endif
 
   private:
     /*
-      Negative is error in communication
-      5 is OK
-      0..4 is too few bytes.
+      Completion of the read transaction
     */
-    int readSensor();
+    static void onTransaction(twi_transaction_t *transaction);
+    int8_t convert(uint8_t twi_status);
 
   private:
-    float humidity;
-    float temperature;
+    int16_t humidity;
+    int16_t temperature;
+    int8_t status;
+    bool data;
+    uint8_t reg;
     uint8_t bits[5];
+    twi_transaction_t transaction;
+    void (*callback)(int8_t status);
 };
 
 #endif
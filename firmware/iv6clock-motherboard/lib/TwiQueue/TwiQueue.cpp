@@ -0,0 +1,245 @@
+#include <TwiQueue.h>
+
+#include <util/delay.h>
+#include <util/twi.h>
+
+#define TWI_PIN_SDA PC4
+#define TWI_PIN_SCL PC5
+
+#define TWI_CONTINUE (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+
+#define TWI_QUEUE_MASK (TWI_QUEUE_SIZE - 1)
+
+/*
+  Free running indices:
+  head   - next transaction to dispatch the callback of
+  active - transaction on the bus
+  tail   - next free slot
+*/
+static twi_transaction_t *queue[TWI_QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_active;
+static volatile uint8_t queue_tail;
+
+static volatile uint8_t twi_index;
+static volatile uint8_t twi_reading;
+static volatile unsigned long twi_started;
+
+static uint8_t twi_recoveries;
+
+static inline twi_transaction_t *twi_active()
+{
+    return queue[queue_active & TWI_QUEUE_MASK];
+}
+
+/*
+  Starts the next transaction if there is one.
+  Interrupts must be disabled or the caller is the ISR.
+*/
+static void twi_start(uint8_t control)
+{
+    if (queue_active == queue_tail)
+    {
+        TWCR = control;
+        return;
+    }
+
+    twi_started = millis();
+    TWCR = control | _BV(TWSTA);
+}
+
+static void twi_complete(uint8_t status, uint8_t control)
+{
+    twi_active()->status = status;
+    queue_active++;
+
+    twi_start(control);
+}
+
+ISR(TWI_vect)
+{
+    twi_transaction_t *transaction = twi_active();
+
+    switch (TW_STATUS)
+    {
+    case TW_START:
+    case TW_REP_START:
+        twi_reading = TW_STATUS == TW_REP_START || transaction->tx_len == 0;
+        twi_index = 0;
+        TWDR = (transaction->address << 1) | (twi_reading ? TW_READ : TW_WRITE);
+        TWCR = TWI_CONTINUE;
+        break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+        if (twi_index < transaction->tx_len)
+        {
+            TWDR = transaction->tx[twi_index++];
+            TWCR = TWI_CONTINUE;
+        }
+        else if (transaction->rx_len > 0)
+        {
+            TWCR = TWI_CONTINUE | _BV(TWSTA);
+        }
+        else
+        {
+            twi_complete(TWI_STATUS_OK, TWI_CONTINUE | _BV(TWSTO));
+        }
+        break;
+
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+        twi_complete(TWI_STATUS_NACK_ADDRESS, TWI_CONTINUE | _BV(TWSTO));
+        break;
+
+    case TW_MT_DATA_NACK:
+        twi_complete(TWI_STATUS_NACK_DATA, TWI_CONTINUE | _BV(TWSTO));
+        break;
+
+    case TW_MT_ARB_LOST:
+        // bus released, START again once it is free
+        twi_complete(TWI_STATUS_ARBITRATION_LOST, TWI_CONTINUE);
+        break;
+
+    case TW_MR_DATA_ACK:
+        transaction->rx[twi_index++] = TWDR;
+        // fall through
+    case TW_MR_SLA_ACK:
+        // ACK every byte but the last one
+        if (twi_index + 1 < transaction->rx_len)
+            TWCR = TWI_CONTINUE | _BV(TWEA);
+        else
+            TWCR = TWI_CONTINUE;
+        break;
+
+    case TW_MR_DATA_NACK:
+        transaction->rx[twi_index++] = TWDR;
+        twi_complete(TWI_STATUS_OK, TWI_CONTINUE | _BV(TWSTO));
+        break;
+
+    default:
+        // TW_BUS_ERROR, STOP releases the lines
+        twi_complete(TWI_STATUS_BUS_ERROR, TWI_CONTINUE | _BV(TWSTO));
+        break;
+    }
+}
+
+/*
+  Frees a bus held by a slave stuck mid-byte: clock SCL until SDA is
+  released, then generate a STOP. Runs with the TWI disabled.
+*/
+static void twi_recover()
+{
+    DDRC &= ~(_BV(TWI_PIN_SDA) | _BV(TWI_PIN_SCL));
+    PORTC |= _BV(TWI_PIN_SDA) | _BV(TWI_PIN_SCL);
+
+    for (uint8_t i = 0; i < 9 && !(PINC & _BV(TWI_PIN_SDA)); i++)
+    {
+        PORTC &= ~_BV(TWI_PIN_SCL);
+        DDRC |= _BV(TWI_PIN_SCL);
+        _delay_us(5);
+        DDRC &= ~_BV(TWI_PIN_SCL);
+        PORTC |= _BV(TWI_PIN_SCL);
+        _delay_us(5);
+    }
+
+    PORTC &= ~_BV(TWI_PIN_SDA);
+    DDRC |= _BV(TWI_PIN_SDA);
+    _delay_us(5);
+    DDRC &= ~_BV(TWI_PIN_SDA);
+    PORTC |= _BV(TWI_PIN_SDA);
+    _delay_us(5);
+
+    twi_recoveries++;
+}
+
+void twi_queue_init()
+{
+    // internal pull-ups, as Wire.begin() does
+    PORTC |= _BV(TWI_PIN_SDA) | _BV(TWI_PIN_SCL);
+
+    TWSR = 0;
+    TWBR = ((F_CPU / TWI_FREQUENCY) - 16) / 2;
+    TWCR = _BV(TWEN) | _BV(TWIE);
+}
+
+static bool twi_queued(const twi_transaction_t *transaction)
+{
+    for (uint8_t i = queue_head; i != queue_tail; i++)
+    {
+        if (queue[i & TWI_QUEUE_MASK] == transaction)
+            return true;
+    }
+
+    return false;
+}
+
+bool twi_queue_post(twi_transaction_t *transaction)
+{
+    if (transaction->tx_len == 0 && transaction->rx_len == 0)
+        return false;
+
+    if ((uint8_t)(queue_tail - queue_head) >= TWI_QUEUE_SIZE || twi_queued(transaction))
+        return false;
+
+    transaction->status = TWI_STATUS_PENDING;
+
+    const uint8_t sreg = SREG;
+    cli();
+
+    const bool idle = queue_active == queue_tail;
+    queue[queue_tail & TWI_QUEUE_MASK] = transaction;
+    queue_tail++;
+
+    if (idle)
+    {
+        // a previous STOP may still be on the bus
+        while (TWCR & _BV(TWSTO))
+            ;
+        twi_start(TWI_CONTINUE);
+    }
+
+    SREG = sreg;
+
+    return true;
+}
+
+void twi_queue_poll()
+{
+    uint8_t sreg = SREG;
+    cli();
+    const bool timeout = queue_active != queue_tail && millis() - twi_started > TWI_TIMEOUT_MS;
+    if (timeout)
+        TWCR = 0;
+    SREG = sreg;
+
+    if (timeout)
+    {
+        // the ISR is off, TWCR = 0 also disabled TWIE
+        twi_recover();
+
+        sreg = SREG;
+        cli();
+        twi_complete(TWI_STATUS_TIMEOUT, TWI_CONTINUE);
+        SREG = sreg;
+    }
+
+    while (queue_head != queue_active)
+    {
+        twi_transaction_t *transaction = queue[queue_head & TWI_QUEUE_MASK];
+        queue_head++;
+
+        if (transaction->callback != nullptr)
+            transaction->callback(transaction);
+    }
+}
+
+bool twi_queue_idle()
+{
+    return queue_head == queue_tail;
+}
+
+uint8_t twi_queue_recoveries()
+{
+    return twi_recoveries;
+}
@@ -0,0 +1,74 @@
+#ifndef TWI_QUEUE_H
+#define TWI_QUEUE_H
+
+#include <Arduino.h>
+
+/*
+* Interrupt-driven TWI (I2C) master with a transaction queue.
+*
+* A transaction writes tx_len bytes and/or reads rx_len bytes. When both
+* are set the read follows the write after a repeated START, which is the
+* register read of DS3231 and DHT12. Transactions are owned by the caller
+* and must stay alive until their callback has run.
+*
+* The bus is driven entirely from TWI_vect. Completion callbacks are not
+* called from the ISR, twi_queue_poll() dispatches them from the main loop
+* and also aborts a transaction stuck for longer than TWI_TIMEOUT_MS,
+* clocking the bus free before the next one is started.
+*
+* This replaces Wire, which defines its own TWI_vect, so the two can not be
+* linked together.
+*/
+
+#define TWI_QUEUE_SIZE 4 // power of two
+#define TWI_TIMEOUT_MS 10
+#define TWI_FREQUENCY 100000UL
+
+enum
+{
+    TWI_STATUS_OK,
+    TWI_STATUS_PENDING,
+    TWI_STATUS_NACK_ADDRESS,
+    TWI_STATUS_NACK_DATA,
+    TWI_STATUS_ARBITRATION_LOST,
+    TWI_STATUS_BUS_ERROR,
+    TWI_STATUS_TIMEOUT,
+};
+
+struct twi_transaction_t
+{
+    uint8_t address;
+    const uint8_t *tx;
+    uint8_t tx_len;
+    uint8_t *rx;
+    uint8_t rx_len;
+
+    void (*callback)(twi_transaction_t *transaction);
+    void *context;
+
+    volatile uint8_t status;
+};
+
+/*
+  Enables the TWI and the SDA/SCL pull-ups
+*/
+void twi_queue_init();
+/*
+  Queues the transaction, false if the queue is full or the
+  transaction is still queued or waiting for its callback
+*/
+bool twi_queue_post(twi_transaction_t *transaction);
+/*
+  Dispatches completion callbacks and handles timeouts, call it from loop()
+*/
+void twi_queue_poll();
+/*
+  True when nothing is queued or waiting for its callback
+*/
+bool twi_queue_idle();
+/*
+  Number of bus recoveries since boot
+*/
+uint8_t twi_queue_recoveries();
+
+#endif
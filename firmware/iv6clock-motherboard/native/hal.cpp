@@ -0,0 +1,407 @@
+#include "sim.h"
+
+#include <stdio.h>
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+
+/***********************************
+* Registers
+***********************************/
+
+hal_reg8 PINB;
+hal_reg8 DDRB;
+hal_reg8 PORTB;
+hal_reg8 PINC;
+hal_reg8 DDRC;
+hal_reg8 PORTC;
+hal_reg8 PIND;
+hal_reg8 DDRD;
+hal_reg8 PORTD;
+hal_reg8 TIFR0;
+hal_reg8 TIFR1;
+hal_reg8 TIFR2;
+hal_reg8 PCIFR;
+hal_reg8 EIFR;
+hal_reg8 EIMSK;
+hal_reg8 GPIOR0;
+hal_reg8 EECR;
+hal_reg8 EEDR;
+hal_reg8 GTCCR;
+hal_reg8 TCCR0A;
+hal_reg8 TCCR0B;
+hal_reg8 TCNT0;
+hal_reg8 OCR0A;
+hal_reg8 OCR0B;
+hal_reg8 SPCR;
+hal_reg8 SPSR;
+hal_reg8 SPDR;
+hal_reg8 ACSR;
+hal_reg8 SMCR;
+hal_reg8 MCUSR;
+hal_reg8 MCUCR;
+hal_reg8 SPMCSR;
+hal_reg8 SREG;
+hal_reg8 WDTCSR;
+hal_reg8 CLKPR;
+hal_reg8 PRR;
+hal_reg8 OSCCAL;
+hal_reg8 PCICR;
+hal_reg8 EICRA;
+hal_reg8 PCMSK0;
+hal_reg8 PCMSK1;
+hal_reg8 PCMSK2;
+hal_reg8 TIMSK0;
+hal_reg8 TIMSK1;
+hal_reg8 TIMSK2;
+hal_reg8 ADCSRA;
+hal_reg8 ADCSRB;
+hal_reg8 ADMUX;
+hal_reg8 DIDR0;
+hal_reg8 DIDR1;
+hal_reg8 TCCR1A;
+hal_reg8 TCCR1B;
+hal_reg8 TCCR1C;
+hal_reg8 TCCR2A;
+hal_reg8 TCCR2B;
+hal_reg8 TCNT2;
+hal_reg8 OCR2A;
+hal_reg8 OCR2B;
+hal_reg8 ASSR;
+hal_reg8 TWBR;
+hal_reg8 TWSR;
+hal_reg8 TWAR;
+hal_reg8 TWDR;
+hal_reg8 TWCR;
+hal_reg8 TWAMR;
+hal_reg8 UCSR0A;
+hal_reg8 UCSR0B;
+hal_reg8 UCSR0C;
+hal_reg8 UDR0;
+hal_reg16 EEAR;
+hal_reg16 ADC;
+hal_reg16 TCNT1;
+hal_reg16 ICR1;
+hal_reg16 OCR1A;
+hal_reg16 OCR1B;
+hal_reg16 UBRR0;
+
+void hal_io_access()
+{
+    sim_advance(SIM_COST_IO);
+}
+
+/***********************************
+* Interrupts, sleep
+***********************************/
+
+void cli()
+{
+    SREG.value &= ~0x80;
+}
+
+void sei()
+{
+    SREG.value |= 0x80;
+    sim_dispatch();
+}
+
+void sleep_cpu()
+{
+    sim_sleep();
+}
+
+/***********************************
+* Time
+***********************************/
+
+unsigned long millis()
+{
+    sim_advance(SIM_COST_MILLIS);
+    return sim_now() / (SIM_F_CPU / 1000);
+}
+
+unsigned long micros()
+{
+    sim_advance(SIM_COST_MICROS);
+    return sim_now() / (SIM_F_CPU / 1000000);
+}
+
+void delay(unsigned long ms)
+{
+    sim_advance(SIM_MS(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    sim_advance(SIM_US(us));
+}
+
+void _delay_ms(double ms)
+{
+    sim_advance((uint64_t)(ms * (SIM_F_CPU / 1000)));
+}
+
+void _delay_us(double us)
+{
+    sim_advance((uint64_t)(us * (SIM_F_CPU / 1000000)));
+}
+
+/***********************************
+* Pins
+***********************************/
+
+static hal_reg8 *pin_reg(uint8_t pin, hal_reg8 *portd, hal_reg8 *portb, hal_reg8 *portc, uint8_t *bit)
+{
+    if (pin < 8)
+    {
+        *bit = pin;
+        return portd;
+    }
+    if (pin < 14)
+    {
+        *bit = pin - 8;
+        return portb;
+    }
+
+    *bit = pin - 14;
+    return portc;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    uint8_t bit;
+    hal_reg8 *ddr = pin_reg(pin, &DDRD, &DDRB, &DDRC, &bit);
+    hal_reg8 *port = pin_reg(pin, &PORTD, &PORTB, &PORTC, &bit);
+
+    if (mode == OUTPUT)
+    {
+        *ddr |= _BV(bit);
+        return;
+    }
+
+    *ddr &= ~_BV(bit);
+    if (mode == INPUT_PULLUP)
+        *port |= _BV(bit);
+    else
+        *port &= ~_BV(bit);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    sim_advance(SIM_COST_DIGITAL_WRITE);
+
+    uint8_t bit;
+    hal_reg8 *port = pin_reg(pin, &PORTD, &PORTB, &PORTC, &bit);
+
+    const uint8_t sreg = SREG;
+    cli();
+    if (value == LOW)
+        *port &= ~_BV(bit);
+    else
+        *port |= _BV(bit);
+    SREG = sreg;
+}
+
+int digitalRead(uint8_t pin)
+{
+    sim_advance(SIM_COST_DIGITAL_READ);
+
+    return sim_pin_level(pin) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+    sim_advance(SIM_COST_ANALOG_READ);
+
+    return sim_analog(pin >= 14 ? pin - 14 : pin);
+}
+
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value)
+{
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        if (bit_order == LSBFIRST)
+            digitalWrite(data_pin, (value >> i) & 1);
+        else
+            digitalWrite(data_pin, (value >> (7 - i)) & 1);
+
+        digitalWrite(clock_pin, HIGH);
+        digitalWrite(clock_pin, LOW);
+    }
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode)
+{
+    sim_attach_int(interrupt, handler, mode);
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+    sim_attach_int(interrupt, nullptr, 0);
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max)
+{
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+/***********************************
+* EEPROM
+***********************************/
+
+// avr-libc access sequence against the EEPROM controller of the sim
+static void eeprom_wait()
+{
+    while (EECR & _BV(EEPE))
+        ;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address)
+{
+    eeprom_wait();
+    EEAR = (uintptr_t)address;
+    EECR |= _BV(EERE);
+    return EEDR;
+}
+
+void eeprom_write_byte(uint8_t *address, uint8_t value)
+{
+    eeprom_wait();
+    EEAR = (uintptr_t)address;
+    EEDR = value;
+    EECR |= _BV(EEMPE);
+    EECR |= _BV(EEPE);
+}
+
+void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+    if (eeprom_read_byte(address) != value)
+        eeprom_write_byte(address, value);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+bool eeprom_is_ready()
+{
+    return !(EECR & _BV(EEPE));
+}
+
+/***********************************
+* FastLED
+***********************************/
+
+CFastLED FastLED;
+
+static CRGB *led_data;
+static int led_count;
+static uint8_t led_brightness = 255;
+static uint32_t led_shows;
+static CLEDController led_controller;
+
+void CFastLED::add(CRGB *data, int count)
+{
+    led_data = data;
+    led_count = count;
+}
+
+void CFastLED::setCorrection(uint32_t correction)
+{
+}
+
+void CFastLED::setBrightness(uint8_t scale)
+{
+    led_brightness = scale;
+}
+
+uint8_t CFastLED::getBrightness()
+{
+    return led_brightness;
+}
+
+void CFastLED::setDither(uint8_t dither)
+{
+}
+
+CLEDController &CFastLED::operator[](int)
+{
+    return led_controller;
+}
+
+void CFastLED::show()
+{
+    led_controller.showLeds(led_brightness);
+}
+
+void CLEDController::showLeds(uint8_t)
+{
+    // the clockless WS2812 driver bit-bangs the frame with interrupts off
+    // and turns them on when done, whatever they were before
+    cli();
+    sim_advance(SIM_COST_WS2812_SETUP + led_count * SIM_COST_WS2812_LED + SIM_COST_WS2812_TAIL);
+    sei();
+
+    led_shows++;
+}
+
+uint32_t sim_led_shows()
+{
+    return led_shows;
+}
+
+uint8_t sin8(uint8_t theta)
+{
+    return (uint8_t)lround(128.0 + 127.5 * sin(theta * M_PI / 128.0) - 0.5);
+}
+
+uint8_t triwave8(uint8_t in)
+{
+    if (in & 0x80)
+        in = 255 - in;
+    return in << 1;
+}
+
+void hsv2rgb_rainbow(const CHSV &hsv, CRGB &rgb)
+{
+    // plain hsv, close enough for the LED logic under test
+    const uint8_t region = hsv.hue / 43;
+    const uint8_t remainder = (hsv.hue - region * 43) * 6;
+    const uint8_t v = hsv.value;
+    const uint8_t p = (v * (255 - hsv.saturation)) >> 8;
+    const uint8_t q = (v * (255 - ((hsv.saturation * remainder) >> 8))) >> 8;
+    const uint8_t t = (v * (255 - ((hsv.saturation * (255 - remainder)) >> 8))) >> 8;
+
+    switch (region)
+    {
+    case 0:
+        rgb = CRGB(v, t, p);
+        break;
+    case 1:
+        rgb = CRGB(q, v, p);
+        break;
+    case 2:
+        rgb = CRGB(p, v, t);
+        break;
+    case 3:
+        rgb = CRGB(p, q, v);
+        break;
+    case 4:
+        rgb = CRGB(t, p, v);
+        break;
+    default:
+        rgb = CRGB(v, p, q);
+    }
+}
@@ -0,0 +1,181 @@
+#ifndef NATIVE_HAL_FASTLED_H
+#define NATIVE_HAL_FASTLED_H
+
+#include <Arduino.h>
+
+/*
+* FastLED subset used by the firmware. showLeds() keeps interrupts
+* disabled for the driver setup, the time the WS2812 frame takes on the
+* wire and the millis() correction, then enables them, like the AVR
+* clockless controller does.
+*/
+
+typedef uint8_t fract8;
+
+static inline uint8_t scale8(uint8_t i, fract8 scale)
+{
+    return ((uint16_t)i * (1 + (uint16_t)scale)) >> 8;
+}
+
+static inline uint8_t scale8_video(uint8_t i, fract8 scale)
+{
+    return (((uint16_t)i * scale) >> 8) + ((i && scale) ? 1 : 0);
+}
+
+static inline uint8_t qadd8(uint8_t i, uint8_t j)
+{
+    const unsigned t = i + j;
+    return t > 255 ? 255 : t;
+}
+
+static inline uint8_t qsub8(uint8_t i, uint8_t j)
+{
+    return i > j ? i - j : 0;
+}
+
+static inline uint8_t lerp8by8(uint8_t a, uint8_t b, fract8 frac)
+{
+    return b > a ? a + scale8(b - a, frac) : a - scale8(a - b, frac);
+}
+
+uint8_t sin8(uint8_t theta);
+uint8_t triwave8(uint8_t in);
+
+enum HSVHue
+{
+    HUE_RED = 0,
+    HUE_ORANGE = 32,
+    HUE_YELLOW = 64,
+    HUE_GREEN = 96,
+    HUE_AQUA = 128,
+    HUE_BLUE = 160,
+    HUE_PURPLE = 192,
+    HUE_PINK = 224,
+};
+
+#define DISABLE_DITHER 0x00
+#define BINARY_DITHER 0x01
+
+enum LEDColorCorrection
+{
+    TypicalSMD5050 = 0xFFB0F0,
+    TypicalLEDStrip = 0xFFB0F0,
+    UncorrectedColor = 0xFFFFFF,
+};
+
+enum EOrder
+{
+    RGB = 0012,
+    GRB = 0102,
+};
+
+struct CHSV
+{
+    union
+    {
+        struct
+        {
+            uint8_t hue;
+            uint8_t saturation;
+            uint8_t value;
+        };
+        uint8_t raw[3];
+    };
+
+    CHSV() : hue(0), saturation(0), value(0) {}
+    CHSV(uint8_t h, uint8_t s, uint8_t v) : hue(h), saturation(s), value(v) {}
+
+    bool operator==(const CHSV &other) const
+    {
+        return hue == other.hue && saturation == other.saturation && value == other.value;
+    }
+
+    bool operator!=(const CHSV &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+struct CRGB;
+void hsv2rgb_rainbow(const CHSV &hsv, CRGB &rgb);
+
+struct CRGB
+{
+    union
+    {
+        struct
+        {
+            uint8_t r;
+            uint8_t g;
+            uint8_t b;
+        };
+        uint8_t raw[3];
+    };
+
+    CRGB() : r(0), g(0), b(0) {}
+    CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+    CRGB(const CHSV &hsv)
+    {
+        hsv2rgb_rainbow(hsv, *this);
+    }
+
+    CRGB &operator=(const CHSV &hsv)
+    {
+        hsv2rgb_rainbow(hsv, *this);
+        return *this;
+    }
+
+    bool operator==(const CRGB &other) const
+    {
+        return r == other.r && g == other.g && b == other.b;
+    }
+
+    bool operator!=(const CRGB &other) const
+    {
+        return !(*this == other);
+    }
+
+    CRGB &nscale8_video(uint8_t scale)
+    {
+        r = scale8_video(r, scale);
+        g = scale8_video(g, scale);
+        b = scale8_video(b, scale);
+        return *this;
+    }
+};
+
+template <uint8_t DATA_PIN, EOrder RGB_ORDER>
+class WS2812B
+{
+};
+
+class CLEDController
+{
+  public:
+    void showLeds(uint8_t brightness = 255);
+};
+
+class CFastLED
+{
+  public:
+    CLEDController &operator[](int x);
+
+    template <template <uint8_t DATA_PIN, EOrder RGB_ORDER> class CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+    static void addLeds(CRGB *data, int count)
+    {
+        add(data, count);
+    }
+
+    void setCorrection(uint32_t correction);
+    void setBrightness(uint8_t scale);
+    uint8_t getBrightness();
+    void setDither(uint8_t dither);
+    void show();
+
+  private:
+    static void add(CRGB *data, int count);
+};
+
+extern CFastLED FastLED;
+
+#endif
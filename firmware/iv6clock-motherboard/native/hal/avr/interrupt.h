@@ -0,0 +1,22 @@
+#ifndef NATIVE_HAL_AVR_INTERRUPT_H
+#define NATIVE_HAL_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+/*
+* Interrupt vectors become plain extern "C" functions the simulator calls,
+* cli()/sei() drive the I bit of SREG and sei() dispatches whatever became
+* pending while interrupts were off.
+*/
+
+#define ISR(vector, ...)              \
+    extern "C" void vector(void);     \
+    extern "C" void vector(void)
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+
+void cli();
+void sei();
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef NATIVE_HAL_AVR_IO_H
+#define NATIVE_HAL_AVR_IO_H
+
+#include <stdint.h>
+
+#include "../hal_reg.h"
+
+/*
+* ATmega328P registers as hal_reg objects, see native/hal.cpp.
+*/
+
+#define _BV(bit) (1 << (bit))
+
+extern hal_reg8 PINB;
+extern hal_reg8 DDRB;
+extern hal_reg8 PORTB;
+extern hal_reg8 PINC;
+extern hal_reg8 DDRC;
+extern hal_reg8 PORTC;
+extern hal_reg8 PIND;
+extern hal_reg8 DDRD;
+extern hal_reg8 PORTD;
+extern hal_reg8 TIFR0;
+extern hal_reg8 TIFR1;
+extern hal_reg8 TIFR2;
+extern hal_reg8 PCIFR;
+extern hal_reg8 EIFR;
+extern hal_reg8 EIMSK;
+extern hal_reg8 GPIOR0;
+extern hal_reg8 EECR;
+extern hal_reg8 EEDR;
+extern hal_reg8 GTCCR;
+extern hal_reg8 TCCR0A;
+extern hal_reg8 TCCR0B;
+extern hal_reg8 TCNT0;
+extern hal_reg8 OCR0A;
+extern hal_reg8 OCR0B;
+extern hal_reg8 SPCR;
+extern hal_reg8 SPSR;
+extern hal_reg8 SPDR;
+extern hal_reg8 ACSR;
+extern hal_reg8 SMCR;
+extern hal_reg8 MCUSR;
+extern hal_reg8 MCUCR;
+extern hal_reg8 SPMCSR;
+extern hal_reg8 SREG;
+extern hal_reg8 WDTCSR;
+extern hal_reg8 CLKPR;
+extern hal_reg8 PRR;
+extern hal_reg8 OSCCAL;
+extern hal_reg8 PCICR;
+extern hal_reg8 EICRA;
+extern hal_reg8 PCMSK0;
+extern hal_reg8 PCMSK1;
+extern hal_reg8 PCMSK2;
+extern hal_reg8 TIMSK0;
+extern hal_reg8 TIMSK1;
+extern hal_reg8 TIMSK2;
+extern hal_reg8 ADCSRA;
+extern hal_reg8 ADCSRB;
+extern hal_reg8 ADMUX;
+extern hal_reg8 DIDR0;
+extern hal_reg8 DIDR1;
+extern hal_reg8 TCCR1A;
+extern hal_reg8 TCCR1B;
+extern hal_reg8 TCCR1C;
+extern hal_reg8 TCCR2A;
+extern hal_reg8 TCCR2B;
+extern hal_reg8 TCNT2;
+extern hal_reg8 OCR2A;
+extern hal_reg8 OCR2B;
+extern hal_reg8 ASSR;
+extern hal_reg8 TWBR;
+extern hal_reg8 TWSR;
+extern hal_reg8 TWAR;
+extern hal_reg8 TWDR;
+extern hal_reg8 TWCR;
+extern hal_reg8 TWAMR;
+extern hal_reg8 UCSR0A;
+extern hal_reg8 UCSR0B;
+extern hal_reg8 UCSR0C;
+extern hal_reg8 UDR0;
+
+extern hal_reg16 EEAR;
+extern hal_reg16 ADC;
+extern hal_reg16 TCNT1;
+extern hal_reg16 ICR1;
+extern hal_reg16 OCR1A;
+extern hal_reg16 OCR1B;
+extern hal_reg16 UBRR0;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+#define PCINT0 0
+#define PCINT1 1
+#define PCINT2 2
+#define PCINT3 3
+#define PCINT4 4
+#define PCINT5 5
+#define PCINT6 6
+#define PCINT7 7
+#define PCINT8 0
+#define PCINT9 1
+#define PCINT10 2
+#define PCINT11 3
+#define PCINT12 4
+#define PCINT13 5
+#define PCINT14 6
+#define PCINT16 0
+#define PCINT17 1
+#define PCINT18 2
+#define PCINT19 3
+#define PCINT20 4
+#define PCINT21 5
+#define PCINT22 6
+#define PCINT23 7
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define WGM10 0
+#define WGM11 1
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM20 0
+#define WGM21 1
+#define WGM22 3
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+#define TWPS0 0
+#define TWPS1 1
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define MPCM0 0
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define UMSEL01 7
+#define UMSEL00 6
+#define UPM01 5
+#define UPM00 4
+#define USBS0 3
+#define UCSZ01 2
+#define UCSZ00 1
+#define UCPOL0 0
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+#define ACME 6
+#define ADC0D 0
+#define ADC1D 1
+#define ADC2D 2
+#define ADC3D 3
+#define ADC4D 4
+#define ADC5D 5
+#define ACD 7
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define PRTWI 7
+#define PRTIM2 6
+#define PRTIM0 5
+#define PRTIM1 3
+#define PRSPI 2
+#define PRUSART0 1
+#define PRADC 0
+#define INT0 0
+#define INT1 1
+#define INTF0 0
+#define INTF1 1
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define SREG_I 7
+
+#define RAMEND 0x8FF
+#define E2END 0x3FF
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef NATIVE_HAL_AVR_POWER_H
+#define NATIVE_HAL_AVR_POWER_H
+
+#include <avr/io.h>
+
+#define power_adc_enable() (PRR &= (uint8_t)~_BV(PRADC))
+#define power_adc_disable() (PRR |= _BV(PRADC))
+#define power_spi_enable() (PRR &= (uint8_t)~_BV(PRSPI))
+#define power_spi_disable() (PRR |= _BV(PRSPI))
+#define power_twi_enable() (PRR &= (uint8_t)~_BV(PRTWI))
+#define power_twi_disable() (PRR |= _BV(PRTWI))
+#define power_timer0_enable() (PRR &= (uint8_t)~_BV(PRTIM0))
+#define power_timer0_disable() (PRR |= _BV(PRTIM0))
+#define power_timer1_enable() (PRR &= (uint8_t)~_BV(PRTIM1))
+#define power_timer1_disable() (PRR |= _BV(PRTIM1))
+#define power_timer2_enable() (PRR &= (uint8_t)~_BV(PRTIM2))
+#define power_timer2_disable() (PRR |= _BV(PRTIM2))
+#define power_usart0_enable() (PRR &= (uint8_t)~_BV(PRUSART0))
+#define power_usart0_disable() (PRR |= _BV(PRUSART0))
+
+#endif
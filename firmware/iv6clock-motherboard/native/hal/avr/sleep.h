@@ -0,0 +1,18 @@
+#ifndef NATIVE_HAL_AVR_SLEEP_H
+#define NATIVE_HAL_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN _BV(SM1)
+#define SLEEP_MODE_PWR_SAVE (_BV(SM0) | _BV(SM1))
+
+#define set_sleep_mode(mode) (SMCR = (uint8_t)((SMCR & ~(_BV(SM0) | _BV(SM1) | _BV(SM2))) | (mode)))
+#define sleep_enable() (SMCR |= _BV(SE))
+#define sleep_disable() (SMCR &= (uint8_t)~_BV(SE))
+
+// advances the virtual clock to the next interrupt
+void sleep_cpu();
+
+#endif
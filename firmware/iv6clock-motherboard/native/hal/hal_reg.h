@@ -0,0 +1,66 @@
+#ifndef NATIVE_HAL_REG_H
+#define NATIVE_HAL_REG_H
+
+#include <stdint.h>
+
+/*
+* I/O register of the native HAL.
+*
+* Behaves like the volatile register it replaces. The simulator may hook
+* writes (TWCR, PORTD, SREG, ...) and computed reads (TCNT1) to model the
+* peripheral behind it. A write hook sees the old `value` and stores the
+* new one itself, so write-one-to-clear flags can be modelled.
+*/
+
+// charges SIM_COST_IO to the virtual clock
+void hal_io_access();
+
+template <typename T>
+struct hal_reg
+{
+    T value;
+    void (*on_write)(T value);
+    T (*on_read)();
+
+    operator T() const
+    {
+        hal_io_access();
+        return on_read != nullptr ? on_read() : value;
+    }
+
+    hal_reg &operator=(T v)
+    {
+        hal_io_access();
+        if (on_write != nullptr)
+            on_write(v);
+        else
+            value = v;
+        return *this;
+    }
+
+    hal_reg &operator=(const hal_reg &other)
+    {
+        return *this = (T)other;
+    }
+
+    // int operands, like ~_BV(bit), as on AVR
+    hal_reg &operator|=(int v)
+    {
+        return *this = (T)(*this | v);
+    }
+
+    hal_reg &operator&=(int v)
+    {
+        return *this = (T)(*this & v);
+    }
+
+    hal_reg &operator^=(int v)
+    {
+        return *this = (T)(*this ^ v);
+    }
+};
+
+typedef hal_reg<uint8_t> hal_reg8;
+typedef hal_reg<uint16_t> hal_reg16;
+
+#endif
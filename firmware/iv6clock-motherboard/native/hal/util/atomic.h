@@ -0,0 +1,20 @@
+#ifndef NATIVE_HAL_UTIL_ATOMIC_H
+#define NATIVE_HAL_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+
+static inline uint8_t __hal_atomic_enter()
+{
+    const uint8_t sreg = SREG;
+    cli();
+    return sreg;
+}
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+
+#define ATOMIC_BLOCK(type)                                                    \
+    for (uint8_t __sreg_save = __hal_atomic_enter(), __todo = 1; __todo;      \
+         __todo = 0, (type) == ATOMIC_FORCEON ? sei() : (void)(SREG = __sreg_save))
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef NATIVE_HAL_UTIL_CRC16_H
+#define NATIVE_HAL_UTIL_CRC16_H
+
+#include <stdint.h>
+
+// avr-libc's CRC-8 CCITT, x^8 + x^2 + x + 1, MSB first, no reflection
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++)
+        crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ 0x07 : (uint8_t)(crc << 1);
+
+    return crc;
+}
+
+#endif
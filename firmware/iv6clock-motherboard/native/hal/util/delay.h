@@ -0,0 +1,8 @@
+#ifndef NATIVE_HAL_UTIL_DELAY_H
+#define NATIVE_HAL_UTIL_DELAY_H
+
+// busy waits advance the virtual clock, interrupts keep firing
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif
@@ -0,0 +1,1515 @@
+#include "sim.h"
+
+#include <deque>
+#include <map>
+
+#include <Arduino.h>
+#include <util/twi.h>
+
+/***********************************
+* Firmware vectors
+***********************************/
+
+// weak, so only the vectors the firmware defines are linked
+#define SIM_VECTOR(name) extern "C" void name(void) __attribute__((weak));
+
+SIM_VECTOR(PCINT0_vect)
+SIM_VECTOR(PCINT1_vect)
+SIM_VECTOR(PCINT2_vect)
+SIM_VECTOR(WDT_vect)
+SIM_VECTOR(TIMER2_COMPA_vect)
+SIM_VECTOR(TIMER2_COMPB_vect)
+SIM_VECTOR(TIMER2_OVF_vect)
+SIM_VECTOR(TIMER1_CAPT_vect)
+SIM_VECTOR(TIMER1_COMPA_vect)
+SIM_VECTOR(TIMER1_COMPB_vect)
+SIM_VECTOR(TIMER1_OVF_vect)
+SIM_VECTOR(TIMER0_COMPA_vect)
+SIM_VECTOR(TIMER0_COMPB_vect)
+SIM_VECTOR(SPI_STC_vect)
+SIM_VECTOR(USART_RX_vect)
+SIM_VECTOR(USART_UDRE_vect)
+SIM_VECTOR(USART_TX_vect)
+SIM_VECTOR(ADC_vect)
+SIM_VECTOR(EE_READY_vect)
+SIM_VECTOR(ANALOG_COMP_vect)
+SIM_VECTOR(TWI_vect)
+SIM_VECTOR(SPM_READY_vect)
+
+static void timer0_ovf_vect();
+static void adc_trigger(uint8_t source);
+
+// ADTS of ADCSRB
+#define SIM_ADC_TRIGGER_TIMER0_OVF 4
+static void int0_vect();
+static void int1_vect();
+
+static void (*const vectors[SIM_VECTORS])() = {
+    nullptr,
+    int0_vect,
+    int1_vect,
+    PCINT0_vect,
+    PCINT1_vect,
+    PCINT2_vect,
+    WDT_vect,
+    TIMER2_COMPA_vect,
+    TIMER2_COMPB_vect,
+    TIMER2_OVF_vect,
+    TIMER1_CAPT_vect,
+    TIMER1_COMPA_vect,
+    TIMER1_COMPB_vect,
+    TIMER1_OVF_vect,
+    TIMER0_COMPA_vect,
+    TIMER0_COMPB_vect,
+    timer0_ovf_vect,
+    SPI_STC_vect,
+    USART_RX_vect,
+    USART_UDRE_vect,
+    USART_TX_vect,
+    ADC_vect,
+    EE_READY_vect,
+    ANALOG_COMP_vect,
+    TWI_vect,
+    SPM_READY_vect,
+};
+
+/* Flag of each vector, cleared on ISR entry or by writing a one to it */
+static const struct
+{
+    uint8_t vector;
+    hal_reg8 *reg;
+    uint8_t bit;
+} vector_flags[] = {
+    {SIM_INT0, &EIFR, INTF0},
+    {SIM_INT1, &EIFR, INTF1},
+    {SIM_PCINT0, &PCIFR, PCIF0},
+    {SIM_PCINT1, &PCIFR, PCIF1},
+    {SIM_PCINT2, &PCIFR, PCIF2},
+    {SIM_TIMER2_COMPA, &TIFR2, OCF2A},
+    {SIM_TIMER2_COMPB, &TIFR2, OCF2B},
+    {SIM_TIMER2_OVF, &TIFR2, TOV2},
+    {SIM_TIMER1_CAPT, &TIFR1, ICF1},
+    {SIM_TIMER1_COMPA, &TIFR1, OCF1A},
+    {SIM_TIMER1_COMPB, &TIFR1, OCF1B},
+    {SIM_TIMER1_OVF, &TIFR1, TOV1},
+    {SIM_TIMER0_COMPA, &TIFR0, OCF0A},
+    {SIM_TIMER0_COMPB, &TIFR0, OCF0B},
+    {SIM_TIMER0_OVF, &TIFR0, TOV0},
+    {SIM_ADC, &ADCSRA, ADIF},
+};
+
+/***********************************
+* Clock and interrupts
+***********************************/
+
+#define SIM_NEVER UINT64_MAX
+#define SIM_SREG_I 0x80
+
+// vector fetch + prologue, epilogue + reti
+#define SIM_COST_ISR_ENTRY 7
+#define SIM_COST_ISR_EXIT 5
+
+static uint64_t now;
+static uint32_t pending;
+static bool in_isr;
+static uint32_t isr_counts[SIM_VECTORS];
+static uint32_t isr_total;
+static std::multimap<uint64_t, std::function<void()>> events;
+
+static sim_scan_stats_t scan_stats;
+static uint64_t scan_last_entry;
+
+static void (*int_handlers[2])();
+static int int_modes[2];
+
+uint64_t sim_now()
+{
+    return now;
+}
+
+void sim_at(uint64_t at, std::function<void()> action)
+{
+    events.insert(std::make_pair(at, action));
+}
+
+void sim_raise(uint8_t vector)
+{
+    pending |= 1ul << vector;
+}
+
+uint32_t sim_isr_count(uint8_t vector)
+{
+    return isr_counts[vector];
+}
+
+static void scan_entry()
+{
+    if (scan_last_entry != 0)
+    {
+        const uint32_t period = now - scan_last_entry;
+
+        if (scan_stats.periods == 0 || period < scan_stats.period_min)
+            scan_stats.period_min = period;
+        if (period > scan_stats.period_max)
+            scan_stats.period_max = period;
+
+        scan_stats.periods++;
+        scan_stats.period_sum += period;
+        scan_stats.period_sq_sum += (uint64_t)period * period;
+    }
+
+    scan_last_entry = now;
+}
+
+static void vector_flag_clear(uint8_t vector)
+{
+    for (size_t i = 0; i < sizeof(vector_flags) / sizeof(vector_flags[0]); i++)
+    {
+        if (vector_flags[i].vector == vector)
+            vector_flags[i].reg->value &= ~_BV(vector_flags[i].bit);
+    }
+}
+
+/* Write hook of the flag registers, a one clears the flag and its request */
+static void flags_write(hal_reg8 *reg, uint8_t value)
+{
+    for (size_t i = 0; i < sizeof(vector_flags) / sizeof(vector_flags[0]); i++)
+    {
+        if (vector_flags[i].reg == reg && (value & _BV(vector_flags[i].bit)))
+            pending &= ~(1ul << vector_flags[i].vector);
+    }
+
+    reg->value &= ~value;
+}
+
+static void tifr0_write(uint8_t value)
+{
+    flags_write(&TIFR0, value);
+}
+
+static void tifr1_write(uint8_t value)
+{
+    flags_write(&TIFR1, value);
+}
+
+static void tifr2_write(uint8_t value)
+{
+    flags_write(&TIFR2, value);
+}
+
+static void pcifr_write(uint8_t value)
+{
+    flags_write(&PCIFR, value);
+}
+
+static void eifr_write(uint8_t value)
+{
+    flags_write(&EIFR, value);
+}
+
+void sim_dispatch()
+{
+    while (!in_isr && (SREG.value & SIM_SREG_I) && pending != 0)
+    {
+        uint8_t vector = 1;
+        while (!(pending & (1ul << vector)))
+            vector++;
+
+        pending &= ~(1ul << vector);
+        vector_flag_clear(vector);
+
+        if (vectors[vector] == nullptr)
+            continue;
+
+        isr_counts[vector]++;
+        isr_total++;
+
+        in_isr = true;
+        SREG.value &= ~SIM_SREG_I;
+
+        sim_advance(SIM_COST_ISR_ENTRY);
+        if (vector == SIM_TIMER2_COMPA)
+            scan_entry();
+        vectors[vector]();
+        sim_advance(SIM_COST_ISR_EXIT);
+
+        SREG.value |= SIM_SREG_I;
+        in_isr = false;
+    }
+}
+
+void sim_attach_int(uint8_t interrupt, void (*handler)(), int mode)
+{
+    if (interrupt > 1)
+        return;
+
+    int_handlers[interrupt] = handler;
+    int_modes[interrupt] = mode;
+}
+
+static void int0_vect()
+{
+    if (int_handlers[0] != nullptr)
+        int_handlers[0]();
+}
+
+static void int1_vect()
+{
+    if (int_handlers[1] != nullptr)
+        int_handlers[1]();
+}
+
+/***********************************
+* Timer0, millis()
+***********************************/
+
+// F_CPU / 64 / 256
+#define SIM_TIMER0_PERIOD 16384
+
+static uint64_t timer0_next = SIM_TIMER0_PERIOD;
+
+// the Arduino core's millis() tick, only counted
+static void timer0_ovf_vect()
+{
+}
+
+static void timer0_fire()
+{
+    TIFR0.value |= _BV(TOV0);
+    sim_raise(SIM_TIMER0_OVF);
+    timer0_next += SIM_TIMER0_PERIOD;
+
+    adc_trigger(SIM_ADC_TRIGGER_TIMER0_OVF);
+}
+
+/***********************************
+* Timer1, counter only
+***********************************/
+
+static const uint16_t timer1_prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+static uint64_t timer1_base;
+static uint16_t timer1_frozen;
+
+static uint16_t timer1_count()
+{
+    const uint16_t prescaler = timer1_prescalers[TCCR1B.value & 7];
+    if (prescaler == 0)
+        return timer1_frozen;
+
+    return (uint16_t)((now - timer1_base) / prescaler);
+}
+
+static void timer1_set(uint16_t count)
+{
+    const uint16_t prescaler = timer1_prescalers[TCCR1B.value & 7];
+
+    timer1_frozen = count;
+    if (prescaler != 0)
+        timer1_base = now - (uint64_t)count * prescaler;
+}
+
+static void tccr1b_write(uint8_t value)
+{
+    // keep counting from the current value with the new prescaler
+    const uint16_t count = timer1_count();
+
+    TCCR1B.value = value;
+    timer1_set(count);
+}
+
+static void tcnt1_write(uint16_t value)
+{
+    TCNT1.value = value;
+    timer1_set(value);
+}
+
+/***********************************
+* Timer2, normal and CTC mode
+***********************************/
+
+static const uint16_t timer2_prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+static struct
+{
+    bool running;
+    uint64_t period_start;
+    bool a_done;
+    bool b_done;
+} timer2;
+
+static uint16_t timer2_prescaler()
+{
+    return timer2_prescalers[TCCR2B.value & 7];
+}
+
+static uint16_t timer2_top()
+{
+    return (TCCR2A.value & _BV(WGM21)) ? OCR2A.value : 0xFF;
+}
+
+static uint64_t timer2_at(uint16_t count)
+{
+    return timer2.period_start + (uint64_t)count * timer2_prescaler();
+}
+
+static uint64_t timer2_next()
+{
+    if (!timer2.running)
+        return SIM_NEVER;
+
+    uint64_t next = timer2_at(timer2_top() + 1);
+
+    if (!timer2.a_done && OCR2A.value <= timer2_top() && timer2_at(OCR2A.value) < next)
+        next = timer2_at(OCR2A.value);
+
+    if (!timer2.b_done && OCR2B.value <= timer2_top())
+    {
+        const uint64_t b = timer2_at(OCR2B.value);
+        if (b >= now && b < next)
+            next = b;
+    }
+
+    return next;
+}
+
+static void timer2_fire()
+{
+    if (!timer2.running)
+        return;
+
+    if (!timer2.a_done && OCR2A.value <= timer2_top() && timer2_at(OCR2A.value) <= now)
+    {
+        timer2.a_done = true;
+        TIFR2.value |= _BV(OCF2A);
+        if (TIMSK2.value & _BV(OCIE2A))
+            sim_raise(SIM_TIMER2_COMPA);
+    }
+
+    if (!timer2.b_done && OCR2B.value <= timer2_top() && timer2_at(OCR2B.value) <= now)
+    {
+        timer2.b_done = true;
+
+        // OCR2B moved below the counter, the match is missed this period
+        if (timer2_at(OCR2B.value) == now)
+        {
+            TIFR2.value |= _BV(OCF2B);
+            if (TIMSK2.value & _BV(OCIE2B))
+                sim_raise(SIM_TIMER2_COMPB);
+        }
+    }
+
+    if (timer2_at(timer2_top() + 1) <= now)
+    {
+        timer2.period_start = timer2_at(timer2_top() + 1);
+        timer2.a_done = false;
+        timer2.b_done = false;
+
+        if (!(TCCR2A.value & _BV(WGM21)))
+        {
+            TIFR2.value |= _BV(TOV2);
+            if (TIMSK2.value & _BV(TOIE2))
+                sim_raise(SIM_TIMER2_OVF);
+        }
+    }
+}
+
+static void tccr2b_write(uint8_t value)
+{
+    TCCR2B.value = value;
+
+    const bool running = (value & 7) != 0;
+
+    if (running && !timer2.running)
+    {
+        timer2.period_start = now;
+        timer2.a_done = false;
+        timer2.b_done = false;
+    }
+
+    timer2.running = running;
+}
+
+static void tcnt2_write(uint8_t value)
+{
+    TCNT2.value = value;
+    timer2.period_start = now - (uint64_t)value * timer2_prescaler();
+    timer2.a_done = false;
+    timer2.b_done = false;
+}
+
+static uint8_t tcnt2_read()
+{
+    if (!timer2.running || timer2_prescaler() == 0)
+        return TCNT2.value;
+
+    return (uint8_t)((now - timer2.period_start) / timer2_prescaler());
+}
+
+/***********************************
+* Pins
+***********************************/
+
+static uint8_t inputs[3] = {0xFF, 0xFF, 0xFF};
+static hal_reg8 *const port_regs[3] = {&PORTB, &PORTC, &PORTD};
+static hal_reg8 *const ddr_regs[3] = {&DDRB, &DDRC, &DDRD};
+static hal_reg8 *const pcmsk_regs[3] = {&PCMSK0, &PCMSK1, &PCMSK2};
+static uint16_t analog[8];
+
+enum
+{
+    SIM_PORT_B,
+    SIM_PORT_C,
+    SIM_PORT_D,
+};
+
+static void pin_port(uint8_t pin, uint8_t *port, uint8_t *bit)
+{
+    if (pin < 8)
+    {
+        *port = SIM_PORT_D;
+        *bit = pin;
+    }
+    else if (pin < 14)
+    {
+        *port = SIM_PORT_B;
+        *bit = pin - 8;
+    }
+    else
+    {
+        *port = SIM_PORT_C;
+        *bit = pin - 14;
+    }
+}
+
+static uint8_t port_pins(uint8_t port)
+{
+    const uint8_t ddr = ddr_regs[port]->value;
+    return (port_regs[port]->value & ddr) | (inputs[port] & ~ddr);
+}
+
+static uint8_t pinb_read()
+{
+    return port_pins(SIM_PORT_B);
+}
+
+static uint8_t pinc_read()
+{
+    return port_pins(SIM_PORT_C);
+}
+
+static uint8_t pind_read()
+{
+    return port_pins(SIM_PORT_D);
+}
+
+bool sim_pin_level(uint8_t pin)
+{
+    uint8_t port, bit;
+    pin_port(pin, &port, &bit);
+
+    return port_pins(port) & _BV(bit);
+}
+
+void sim_set_input(uint8_t pin, bool level)
+{
+    uint8_t port, bit;
+    pin_port(pin, &port, &bit);
+
+    const uint8_t before = port_pins(port);
+    if (level)
+        inputs[port] |= _BV(bit);
+    else
+        inputs[port] &= ~_BV(bit);
+    const uint8_t changed = before ^ port_pins(port);
+
+    if (!changed)
+        return;
+
+    const uint8_t group = port == SIM_PORT_B ? 0 : (port == SIM_PORT_C ? 1 : 2);
+    if ((PCICR.value & _BV(group)) && (pcmsk_regs[group]->value & changed))
+    {
+        PCIFR.value |= _BV(group);
+        sim_raise(SIM_PCINT0 + group);
+    }
+
+    if (port == SIM_PORT_D && (bit == PD2 || bit == PD3))
+    {
+        const uint8_t interrupt = bit - PD2;
+        const int mode = int_modes[interrupt];
+
+        if (int_handlers[interrupt] != nullptr &&
+            (mode == CHANGE || (mode == RISING && level) || (mode == FALLING && !level)))
+        {
+            sim_raise(SIM_INT0 + interrupt);
+        }
+    }
+}
+
+void sim_set_analog(uint8_t channel, uint16_t value)
+{
+    analog[channel & 7] = value > 1023 ? 1023 : value;
+}
+
+uint16_t sim_analog(uint8_t channel)
+{
+    return analog[channel & 7];
+}
+
+/***********************************
+* ADC
+***********************************/
+
+// ADC clocks of a conversion, the first after ADEN takes 25
+#define SIM_ADC_CONVERSION 13
+
+static const uint8_t adc_prescalers[8] = {2, 2, 4, 8, 16, 32, 64, 128};
+
+static bool adc_busy;
+
+static void adc_start()
+{
+    if (adc_busy || !(ADCSRA.value & _BV(ADEN)))
+        return;
+
+    adc_busy = true;
+    ADCSRA.value |= _BV(ADSC);
+
+    // the channel is latched when the conversion starts
+    const uint8_t channel = ADMUX.value & 0x0F;
+    const uint64_t cycles = (uint64_t)SIM_ADC_CONVERSION * adc_prescalers[ADCSRA.value & 7];
+
+    sim_at(now + cycles, [channel]() {
+        adc_busy = false;
+        ADC.value = channel < 8 ? analog[channel] : 0;
+        if (ADMUX.value & _BV(ADLAR))
+            ADC.value <<= 6;
+
+        ADCSRA.value = (ADCSRA.value & ~_BV(ADSC)) | _BV(ADIF);
+        if (ADCSRA.value & _BV(ADIE))
+            sim_raise(SIM_ADC);
+    });
+}
+
+static void adc_trigger(uint8_t source)
+{
+    if ((ADCSRA.value & _BV(ADATE)) && (ADCSRB.value & 7) == source)
+        adc_start();
+}
+
+static void adcsra_write(uint8_t value)
+{
+    uint8_t flag = ADCSRA.value & _BV(ADIF);
+
+    // ADIF is cleared by writing a one to it, ADSC reads one while converting
+    if (value & _BV(ADIF))
+    {
+        flag = 0;
+        pending &= ~(1ul << SIM_ADC);
+    }
+
+    ADCSRA.value = (value & ~(_BV(ADIF) | _BV(ADSC))) | flag | (adc_busy ? _BV(ADSC) : 0);
+
+    if (!(value & _BV(ADEN)))
+        return;
+    if (value & _BV(ADSC))
+        adc_start();
+}
+
+/***********************************
+* Stimulus
+***********************************/
+
+#define PIN_SIM_ENCODER_A 2
+#define PIN_SIM_ENCODER_B 3
+#define PIN_SIM_ENCODER_BTN 4
+
+void sim_encoder_rotate(uint64_t at, int detents, uint32_t detent_us)
+{
+    // one detent is a full gray code cycle starting and ending at A = B = 1
+    static const uint8_t clockwise[4][2] = {{1, 0}, {0, 0}, {0, 1}, {1, 1}};
+    static const uint8_t counter_clockwise[4][2] = {{0, 1}, {0, 0}, {1, 0}, {1, 1}};
+
+    const uint8_t(*sequence)[2] = detents > 0 ? clockwise : counter_clockwise;
+    const int count = detents > 0 ? detents : -detents;
+    const uint64_t step = SIM_US(detent_us) / 4;
+
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            const uint8_t a = sequence[j][0];
+            const uint8_t b = sequence[j][1];
+
+            sim_at(at + (uint64_t)(i * 4 + j) * step, [a, b]() {
+                sim_set_input(PIN_SIM_ENCODER_A, a);
+                sim_set_input(PIN_SIM_ENCODER_B, b);
+            });
+        }
+    }
+}
+
+static void button_edge(uint64_t at, bool level)
+{
+    // contact bounce: two short glitches before the level settles
+    sim_at(at, [level]() { sim_set_input(PIN_SIM_ENCODER_BTN, level); });
+    sim_at(at + SIM_US(150), [level]() { sim_set_input(PIN_SIM_ENCODER_BTN, !level); });
+    sim_at(at + SIM_US(300), [level]() { sim_set_input(PIN_SIM_ENCODER_BTN, level); });
+    sim_at(at + SIM_US(700), [level]() { sim_set_input(PIN_SIM_ENCODER_BTN, !level); });
+    sim_at(at + SIM_US(900), [level]() { sim_set_input(PIN_SIM_ENCODER_BTN, level); });
+}
+
+void sim_button_press(uint64_t at, uint32_t hold_ms)
+{
+    button_edge(at, true);
+    button_edge(at + SIM_MS(hold_ms), false);
+}
+
+/***********************************
+* Shift register
+***********************************/
+
+// rev1 board wiring of iv6_n.h, bit of the 16 bit word, byte1 is the high byte
+static const uint8_t sr_grid_bits[5] = {4, 14, 13, 12, 11};
+static const uint8_t sr_segment_bits[8] = {7, 1, 3, 15, 10, 5, 6, 2}; // A..G, dp
+
+static const struct
+{
+    uint8_t segments;
+    char symbol;
+} sr_glyphs[] = {
+    {0x00, ' '}, {0x3F, '0'}, {0x06, '1'}, {0x5B, '2'}, {0x4F, '3'}, {0x66, '4'},
+    {0x6D, '5'}, {0x7D, '6'}, {0x07, '7'}, {0x7F, '8'}, {0x6F, '9'}, {0x40, '-'},
+    {0x77, 'A'}, {0x7C, 'b'}, {0x39, 'C'}, {0x58, 'c'}, {0x5E, 'd'}, {0x79, 'E'},
+    {0x71, 'F'}, {0x3D, 'G'}, {0x76, 'H'}, {0x74, 'h'}, {0x1E, 'J'}, {0x38, 'L'},
+    {0x54, 'n'}, {0x5C, 'o'}, {0x73, 'P'}, {0x67, 'q'}, {0x50, 'r'}, {0x78, 't'},
+    {0x3E, 'U'}, {0x1C, 'u'}, {0x6E, 'y'}, {0x63, '*'}, {0x08, '_'}, {0x48, '='},
+    {0x30, 'I'},
+};
+
+static uint8_t sr_portd;
+static uint16_t sr_shift;
+static int8_t sr_lit_grid = -1;
+static int8_t sr_last_grid = -1;
+static uint64_t sr_lit_since;
+// segments lit per grid during the current scan cycle
+static uint8_t sr_cycle[5];
+static std::string sr_text = "     ";
+static void (*display_change)(const std::string &text);
+
+static char sr_glyph(uint8_t segments)
+{
+    for (size_t i = 0; i < sizeof(sr_glyphs) / sizeof(sr_glyphs[0]); i++)
+    {
+        if (sr_glyphs[i].segments == (segments & 0x7F))
+            return sr_glyphs[i].symbol;
+    }
+
+    return '?';
+}
+
+/* Publishes what the finished scan cycle showed, tubes left dark are blank */
+static void sr_cycle_end()
+{
+    std::string text;
+
+    // grid 4 is the leftmost tube
+    for (int grid = 4; grid >= 0; grid--)
+    {
+        text += sr_glyph(sr_cycle[grid]);
+        if (sr_cycle[grid] & 0x80)
+            text += '.';
+    }
+
+    memset(sr_cycle, 0, sizeof(sr_cycle));
+
+    if (text != sr_text)
+    {
+        sr_text = text;
+        if (display_change != nullptr)
+            display_change(sr_text);
+    }
+}
+
+static void sr_latch(uint16_t word)
+{
+    // the drivers invert the register outputs
+    const uint16_t lit = ~word;
+
+    scan_stats.latches++;
+
+    if (sr_lit_grid >= 0)
+        scan_stats.on_cycles[sr_lit_grid] += now - sr_lit_since;
+
+    sr_lit_grid = -1;
+    sr_lit_since = now;
+
+    for (int grid = 0; grid < 5; grid++)
+    {
+        if (!(lit & (1u << sr_grid_bits[grid])))
+            continue;
+
+        uint8_t segments = 0;
+        for (int segment = 0; segment < 8; segment++)
+        {
+            if (lit & (1u << sr_segment_bits[segment]))
+                segments |= 1u << segment;
+        }
+
+        // the scan wrapped around
+        if (grid <= sr_last_grid)
+            sr_cycle_end();
+
+        sr_cycle[grid] = segments;
+        sr_lit_grid = grid;
+        sr_last_grid = grid;
+        break;
+    }
+}
+
+static void portd_write(uint8_t value)
+{
+    PORTD.value = value;
+    const uint8_t rising = value & ~sr_portd;
+
+    if (rising & _BV(PD6))
+        sr_shift = (sr_shift << 1) | ((value >> PD5) & 1);
+    if (rising & _BV(PD7))
+        sr_latch(sr_shift);
+
+    sr_portd = value;
+}
+
+std::string sim_display_text()
+{
+    return sr_text;
+}
+
+const sim_scan_stats_t *sim_scan_stats()
+{
+    return &scan_stats;
+}
+
+void sim_scan_stats_reset()
+{
+    scan_stats = sim_scan_stats_t();
+    scan_last_entry = 0;
+}
+
+void sim_on_display_change(void (*callback)(const std::string &text))
+{
+    display_change = callback;
+}
+
+/***********************************
+* TWI bus
+***********************************/
+
+struct sim_i2c_device
+{
+    uint8_t address;
+
+    explicit sim_i2c_device(uint8_t addr) : address(addr) {}
+    virtual ~sim_i2c_device() {}
+
+    virtual void start(bool read) {}
+    virtual bool write(uint8_t value) = 0;
+    virtual uint8_t read() = 0;
+    virtual void stop() {}
+};
+
+/* DS3231, time and control registers, 1 Hz SQW */
+struct sim_ds3231 : sim_i2c_device
+{
+    uint8_t registers[0x13];
+    uint8_t pointer;
+    bool pointer_set;
+
+    // seconds since midnight at `epoch`, a whole second boundary
+    uint32_t base;
+    uint64_t epoch;
+
+    sim_ds3231() : sim_i2c_device(0x68), pointer(0), pointer_set(false), base(0), epoch(0)
+    {
+        memset(registers, 0, sizeof(registers));
+        registers[0x0E] = 0x1C; // INTCN, RS = 8 kHz
+    }
+
+    static uint8_t bcd(uint8_t value)
+    {
+        return (value / 10) << 4 | value % 10;
+    }
+
+    static uint8_t bin(uint8_t value)
+    {
+        return (value >> 4) * 10 + (value & 0x0F);
+    }
+
+    uint32_t seconds() const
+    {
+        return (base + (now - epoch) / SIM_F_CPU) % 86400;
+    }
+
+    void set(uint32_t hour, uint32_t minute, uint32_t second, bool reset_chain)
+    {
+        if (reset_chain)
+        {
+            epoch = now;
+            base = (hour * 60 + minute) * 60 + second;
+        }
+        else
+        {
+            // keep the countdown chain, shift the time
+            const uint32_t elapsed = (now - epoch) / SIM_F_CPU;
+            base = ((hour * 60 + minute) * 60 + second + 86400 - elapsed % 86400) % 86400;
+        }
+    }
+
+    void start(bool read) override
+    {
+        pointer_set = read;
+    }
+
+    bool write(uint8_t value) override
+    {
+        if (!pointer_set)
+        {
+            pointer = value % sizeof(registers);
+            pointer_set = true;
+            return true;
+        }
+
+        const uint32_t s = seconds();
+        uint32_t hour = s / 3600, minute = s / 60 % 60, second = s % 60;
+
+        switch (pointer)
+        {
+        case 0x00:
+            second = bin(value & 0x7F);
+            set(hour, minute, second, true);
+            break;
+        case 0x01:
+            minute = bin(value & 0x7F);
+            set(hour, minute, second, false);
+            break;
+        case 0x02:
+            hour = bin(value & 0x3F);
+            set(hour, minute, second, false);
+            break;
+        default:
+            registers[pointer] = value;
+        }
+
+        pointer = (pointer + 1) % sizeof(registers);
+        return true;
+    }
+
+    uint8_t read() override
+    {
+        const uint32_t s = seconds();
+        uint8_t value;
+
+        switch (pointer)
+        {
+        case 0x00:
+            value = bcd(s % 60);
+            break;
+        case 0x01:
+            value = bcd(s / 60 % 60);
+            break;
+        case 0x02:
+            value = bcd(s / 3600);
+            break;
+        default:
+            value = registers[pointer];
+        }
+
+        pointer = (pointer + 1) % sizeof(registers);
+        return value;
+    }
+
+    bool sqw_enabled() const
+    {
+        // INTCN clear, RS = 1 Hz
+        return (registers[0x0E] & 0x1C) == 0;
+    }
+
+    /* SQW is low for the first half of each second, falling with the seconds update */
+    uint64_t next_edge(uint64_t after) const
+    {
+        if (!sqw_enabled())
+            return SIM_NEVER;
+
+        const uint64_t half = SIM_F_CPU / 2;
+        const uint64_t from = after > epoch ? after : epoch;
+        return epoch + ((from - epoch) / half + 1) * half;
+    }
+
+    bool sqw_level() const
+    {
+        return ((now - epoch) / (SIM_F_CPU / 2)) & 1;
+    }
+};
+
+/* DHT12, five data registers */
+struct sim_dht12 : sim_i2c_device
+{
+    uint8_t registers[5];
+    uint8_t pointer;
+    bool pointer_set;
+
+    sim_dht12() : sim_i2c_device(0x5C), pointer(0), pointer_set(false)
+    {
+        set(215, 400);
+    }
+
+    void set(int16_t temperature10, uint16_t humidity10)
+    {
+        const uint16_t magnitude = temperature10 < 0 ? -temperature10 : temperature10;
+
+        registers[0] = humidity10 / 10;
+        registers[1] = humidity10 % 10;
+        registers[2] = (magnitude / 10) | (temperature10 < 0 ? 0x80 : 0);
+        registers[3] = magnitude % 10;
+        registers[4] = registers[0] + registers[1] + registers[2] + registers[3];
+    }
+
+    void start(bool read) override
+    {
+        pointer_set = read;
+    }
+
+    bool write(uint8_t value) override
+    {
+        if (!pointer_set)
+        {
+            pointer = value;
+            pointer_set = true;
+        }
+        return true;
+    }
+
+    uint8_t read() override
+    {
+        return pointer < sizeof(registers) ? registers[pointer++] : 0xFF;
+    }
+};
+
+static sim_ds3231 ds3231;
+static sim_dht12 dht12_sensor;
+static sim_i2c_device *const i2c_devices[] = {&ds3231, &dht12_sensor};
+
+enum
+{
+    SIM_TWI_IDLE,
+    SIM_TWI_STARTED,
+    SIM_TWI_WRITE,
+    SIM_TWI_READ,
+    SIM_TWI_NACKED,
+};
+
+static struct
+{
+    uint8_t state;
+    bool flag;
+    bool busy;
+    sim_i2c_device *device;
+} twi;
+
+static uint64_t twi_bit_cycles()
+{
+    static const uint8_t prescalers[4] = {1, 4, 16, 64};
+    return 16 + 2 * (uint64_t)TWBR.value * prescalers[TWSR.value & 3];
+}
+
+static void twi_done(uint64_t bits, uint8_t status, int data)
+{
+    twi.busy = true;
+
+    sim_at(now + bits * twi_bit_cycles(), [status, data]() {
+        twi.busy = false;
+        if (data >= 0)
+            TWDR.value = data;
+        TWSR.value = (TWSR.value & 3) | status;
+        twi.flag = true;
+        TWCR.value |= _BV(TWINT);
+        if (TWCR.value & _BV(TWIE))
+            sim_raise(SIM_TWI);
+    });
+}
+
+static void twi_stop()
+{
+    if (twi.device != nullptr)
+        twi.device->stop();
+
+    twi.device = nullptr;
+    twi.state = SIM_TWI_IDLE;
+}
+
+static void twcr_write(uint8_t value)
+{
+    // TWINT is cleared by writing a one to it
+    if (value & _BV(TWINT))
+        twi.flag = false;
+
+    TWCR.value = (value & ~_BV(TWINT)) | (twi.flag ? _BV(TWINT) : 0);
+
+    if (!(value & _BV(TWEN)))
+    {
+        twi_stop();
+        twi.flag = false;
+        return;
+    }
+
+    if (twi.flag || twi.busy)
+        return;
+
+    if (value & _BV(TWSTO))
+    {
+        twi_stop();
+        TWCR.value &= ~_BV(TWSTO);
+
+        if (!(value & _BV(TWSTA)))
+            return;
+    }
+
+    if (value & _BV(TWSTA))
+    {
+        twi_done(1, twi.state == SIM_TWI_IDLE ? TW_START : TW_REP_START, -1);
+        twi.state = SIM_TWI_STARTED;
+        return;
+    }
+
+    switch (twi.state)
+    {
+    case SIM_TWI_STARTED:
+    {
+        const uint8_t address = TWDR.value >> 1;
+        const bool read = TWDR.value & TW_READ;
+
+        twi.device = nullptr;
+        for (size_t i = 0; i < sizeof(i2c_devices) / sizeof(i2c_devices[0]); i++)
+        {
+            if (i2c_devices[i]->address == address)
+                twi.device = i2c_devices[i];
+        }
+
+        if (twi.device == nullptr)
+        {
+            twi.state = SIM_TWI_NACKED;
+            twi_done(9, read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK, -1);
+            break;
+        }
+
+        twi.device->start(read);
+        twi.state = read ? SIM_TWI_READ : SIM_TWI_WRITE;
+        twi_done(9, read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK, -1);
+        break;
+    }
+    case SIM_TWI_WRITE:
+        twi_done(9, twi.device->write(TWDR.value) ? TW_MT_DATA_ACK : TW_MT_DATA_NACK, -1);
+        break;
+    case SIM_TWI_READ:
+        twi_done(9, (value & _BV(TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK, twi.device->read());
+        break;
+    default:
+        break;
+    }
+}
+
+void sim_rtc_set(uint8_t hour, uint8_t minute, uint8_t second)
+{
+    ds3231.set(hour, minute, second, true);
+}
+
+void sim_dht12_set(int16_t temperature10, uint16_t humidity10)
+{
+    dht12_sensor.set(temperature10, humidity10);
+}
+
+#define PIN_SIM_SQW 10
+
+// time of the last edge driven onto the pin
+static uint64_t sqw_last;
+
+static uint64_t sqw_next()
+{
+    // first edge at or after now that was not driven yet
+    const uint64_t after = now > 0 ? now - 1 : 0;
+    return ds3231.next_edge(sqw_last > after ? sqw_last : after);
+}
+
+static void sqw_fire()
+{
+    sqw_last = now;
+    sim_set_input(PIN_SIM_SQW, ds3231.sqw_level());
+}
+
+/***********************************
+* EEPROM
+***********************************/
+
+// the cell array, erased by sim_init()
+static uint8_t eeprom[SIM_EEPROM_SIZE];
+
+uint8_t *sim_eeprom()
+{
+    return eeprom;
+}
+
+/* EE_READY is a level interrupt, requested while EERIE is set and no write runs */
+static void eeprom_ready()
+{
+    if ((EECR.value & _BV(EERIE)) && !(EECR.value & _BV(EEPE)))
+        pending |= 1ul << SIM_EE_READY;
+    else
+        pending &= ~(1ul << SIM_EE_READY);
+}
+
+static void eecr_write(uint8_t value)
+{
+    const uint8_t old = EECR.value;
+
+    // EEPE and EERE are only set by the hardware sequence below
+    EECR.value = (value & ~(_BV(EEPE) | _BV(EERE))) | (old & _BV(EEPE));
+
+    if (old & _BV(EEPE))
+    {
+        eeprom_ready();
+        return;
+    }
+
+    if (value & _BV(EERE))
+        EEDR.value = eeprom[EEAR.value % SIM_EEPROM_SIZE];
+
+    if ((value & _BV(EEPE)) && (old & _BV(EEMPE)))
+    {
+        const uint16_t address = EEAR.value % SIM_EEPROM_SIZE;
+        const uint8_t data = EEDR.value;
+
+        EECR.value = (EECR.value & ~_BV(EEMPE)) | _BV(EEPE);
+        sim_at(now + SIM_COST_EEPROM_WRITE, [address, data]() {
+            eeprom[address] = data;
+            EECR.value &= ~_BV(EEPE);
+            eeprom_ready();
+        });
+    }
+    else if ((value & _BV(EEMPE)) && !(old & _BV(EEMPE)))
+    {
+        // the master write enable holds for the four cycles after this one
+        sim_at(now + 5, []() { EECR.value &= ~_BV(EEMPE); });
+    }
+
+    eeprom_ready();
+}
+
+/***********************************
+* USART0
+***********************************/
+
+// the receiver holds two bytes, a third one overruns
+#define SIM_USART_RX_FIFO 2
+
+// bytes on the RX line not yet received, the UDR0 receive FIFO
+static std::deque<uint8_t> usart_line;
+static std::deque<uint8_t> usart_rx;
+static bool usart_receiving;
+
+// the transmit shift register and the UDR0 buffer in front of it
+static bool usart_shifting;
+static bool usart_buffered;
+static uint8_t usart_buffer;
+
+static void (*serial_output)(uint8_t value);
+
+void sim_on_serial_output(void (*callback)(uint8_t value))
+{
+    serial_output = callback;
+}
+
+static bool usart_spi_mode()
+{
+    return (UCSR0C.value & (_BV(UMSEL01) | _BV(UMSEL00))) == (_BV(UMSEL01) | _BV(UMSEL00));
+}
+
+/* One byte on the wire: 8N1 in async mode, 8 bits at F_CPU / 2 (UBRR + 1) in Master SPI mode */
+static uint64_t usart_frame_cycles()
+{
+    if (usart_spi_mode())
+        return 8 * 2 * (UBRR0.value + 1ull);
+
+    return 10 * (UCSR0A.value & _BV(U2X0) ? 8 : 16) * (UBRR0.value + 1ull);
+}
+
+/* RX, UDRE and TX are level interrupts on their flag and enable bits */
+static void usart_update()
+{
+    static const struct
+    {
+        uint8_t vector;
+        uint8_t flag;
+        uint8_t enable;
+    } levels[] = {
+        {SIM_USART_RX, RXC0, RXCIE0},
+        {SIM_USART_UDRE, UDRE0, UDRIE0},
+        {SIM_USART_TX, TXC0, TXCIE0},
+    };
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+    {
+        if ((UCSR0A.value & _BV(levels[i].flag)) && (UCSR0B.value & _BV(levels[i].enable)))
+            pending |= 1ul << levels[i].vector;
+        else
+            pending &= ~(1ul << levels[i].vector);
+    }
+}
+
+static void usart_receive()
+{
+    const uint8_t value = usart_line.front();
+    usart_line.pop_front();
+
+    if (UCSR0B.value & _BV(RXEN0))
+    {
+        if (usart_rx.size() < SIM_USART_RX_FIFO)
+            usart_rx.push_back(value);
+        else
+            UCSR0A.value |= _BV(DOR0);
+
+        UCSR0A.value |= _BV(RXC0);
+        usart_update();
+    }
+
+    usart_receiving = !usart_line.empty();
+    if (usart_receiving)
+        sim_at(now + usart_frame_cycles(), usart_receive);
+}
+
+void sim_serial_input(uint64_t at, const std::string &bytes)
+{
+    sim_at(at, [bytes]() {
+        usart_line.insert(usart_line.end(), bytes.begin(), bytes.end());
+        if (usart_receiving || usart_line.empty())
+            return;
+
+        usart_receiving = true;
+        sim_at(now + usart_frame_cycles(), usart_receive);
+    });
+}
+
+static void usart_shift(uint8_t value)
+{
+    usart_shifting = true;
+    sim_at(now + usart_frame_cycles(), [value]() {
+        if (serial_output != nullptr && !usart_spi_mode())
+            serial_output(value);
+
+        if (usart_buffered)
+        {
+            usart_buffered = false;
+            UCSR0A.value |= _BV(UDRE0);
+            usart_shift(usart_buffer);
+        }
+        else
+        {
+            usart_shifting = false;
+            UCSR0A.value |= _BV(TXC0);
+        }
+
+        usart_update();
+    });
+}
+
+static uint8_t udr0_read()
+{
+    if (usart_rx.empty())
+        return 0;
+
+    const uint8_t value = usart_rx.front();
+    usart_rx.pop_front();
+
+    UCSR0A.value &= ~_BV(DOR0);
+    if (usart_rx.empty())
+        UCSR0A.value &= ~_BV(RXC0);
+    usart_update();
+
+    return value;
+}
+
+static void udr0_write(uint8_t value)
+{
+    // UDR0 reads the receive FIFO, `value` is left to it
+    if (!(UCSR0B.value & _BV(TXEN0)) || !(UCSR0A.value & _BV(UDRE0)))
+        return;
+
+    UCSR0A.value &= ~_BV(TXC0);
+    if (usart_shifting)
+    {
+        usart_buffer = value;
+        usart_buffered = true;
+        UCSR0A.value &= ~_BV(UDRE0);
+    }
+    else
+    {
+        usart_shift(value);
+    }
+
+    usart_update();
+}
+
+static void ucsr0a_write(uint8_t value)
+{
+    // U2X0 and MPCM0 are writable, TXC0 is cleared by writing a one to it
+    const uint8_t writable = _BV(U2X0) | _BV(MPCM0);
+    const uint8_t cleared = value & _BV(TXC0);
+
+    UCSR0A.value = (UCSR0A.value & ~(writable | cleared)) | (value & writable);
+    usart_update();
+}
+
+static void ucsr0b_write(uint8_t value)
+{
+    UCSR0B.value = value;
+
+    if (!(value & _BV(RXEN0)))
+    {
+        usart_rx.clear();
+        UCSR0A.value &= ~(_BV(RXC0) | _BV(DOR0));
+    }
+
+    usart_update();
+}
+
+/***********************************
+* Event loop
+***********************************/
+
+static uint64_t next_event()
+{
+    uint64_t next = timer0_next;
+
+    const uint64_t t2 = timer2_next();
+    if (t2 < next)
+        next = t2;
+
+    const uint64_t sqw = sqw_next();
+    if (sqw < next)
+        next = sqw;
+
+    if (!events.empty() && events.begin()->first < next)
+        next = events.begin()->first;
+
+    return next;
+}
+
+static void fire_events()
+{
+    if (timer0_next <= now)
+        timer0_fire();
+
+    if (timer2_next() <= now)
+        timer2_fire();
+
+    if (sqw_next() <= now)
+        sqw_fire();
+
+    while (!events.empty() && events.begin()->first <= now)
+    {
+        std::function<void()> action = events.begin()->second;
+        events.erase(events.begin());
+        action();
+    }
+}
+
+static void run_until(uint64_t target)
+{
+    for (;;)
+    {
+        const uint64_t next = next_event();
+        if (next > target)
+            break;
+
+        if (next > now)
+            now = next;
+
+        fire_events();
+        sim_dispatch();
+    }
+
+    if (target > now)
+        now = target;
+}
+
+void sim_advance(uint64_t cycles)
+{
+    run_until(now + cycles);
+}
+
+void sim_sleep()
+{
+    if (!(SMCR.value & _BV(SE)))
+        return;
+
+    const uint32_t served = isr_total;
+
+    while (isr_total == served)
+    {
+        const uint64_t next = next_event();
+        if (next == SIM_NEVER)
+            break;
+
+        run_until(next);
+    }
+}
+
+static void sreg_write(uint8_t value)
+{
+    SREG.value = value;
+    if (value & SIM_SREG_I)
+        sim_dispatch();
+}
+
+void sim_init()
+{
+    SREG.value = SIM_SREG_I;
+    SREG.on_write = sreg_write;
+
+    PINB.on_read = pinb_read;
+    PINC.on_read = pinc_read;
+    PIND.on_read = pind_read;
+    PORTD.on_write = portd_write;
+
+    TCCR1B.on_write = tccr1b_write;
+    TCNT1.on_read = timer1_count;
+    TCNT1.on_write = tcnt1_write;
+
+    TCCR2B.on_write = tccr2b_write;
+    TCNT2.on_read = tcnt2_read;
+    TCNT2.on_write = tcnt2_write;
+
+    TIFR0.on_write = tifr0_write;
+    TIFR1.on_write = tifr1_write;
+    TIFR2.on_write = tifr2_write;
+    PCIFR.on_write = pcifr_write;
+    EIFR.on_write = eifr_write;
+
+    TWCR.on_write = twcr_write;
+    TWSR.value = 0xF8;
+
+    UCSR0A.value = _BV(UDRE0);
+    UCSR0A.on_write = ucsr0a_write;
+    UCSR0B.on_write = ucsr0b_write;
+    UDR0.on_read = udr0_read;
+    UDR0.on_write = udr0_write;
+
+    EECR.on_write = eecr_write;
+    ADCSRA.on_write = adcsra_write;
+
+    // encoder idles with A and B high, the button is active high
+    inputs[SIM_PORT_D] &= ~_BV(PIN_SIM_ENCODER_BTN);
+
+    memset(sim_eeprom(), 0xFF, SIM_EEPROM_SIZE);
+    ds3231.set(12, 0, 0, true);
+    sim_set_analog(2, 800);
+}
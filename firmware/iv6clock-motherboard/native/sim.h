@@ -0,0 +1,153 @@
+#ifndef NATIVE_SIM_H
+#define NATIVE_SIM_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+/*
+* Virtual ATmega328P for the native build.
+*
+* Time is a virtual cycle counter at F_CPU. It only moves when the
+* firmware spends time: busy waits, sleep_cpu(), and a nominal cost
+* charged by every HAL call (SIM_COST_*). While it moves, the modelled
+* peripherals raise interrupts which are dispatched as soon as the I bit
+* allows, in vector order, so ISR timing, cli() windows and scheduling are
+* reproducible run after run.
+*
+* Modelled: Timer0 (millis/micros, overflow wakeups), Timer1 counter,
+* Timer2 normal/CTC with compare A/B, pin change and INT0/INT1 interrupts,
+* the ADC (single and Timer0 triggered conversions), the TWI master with a
+* DS3231 (time registers, 1 Hz SQW) and a DHT12 on the bus, the EEPROM
+* controller (3.4 ms writes, EE_READY), USART0 (8N1 at the programmed
+* baud rate, two byte receive FIFO, Master SPI timing), and the 74HC595
+* chain on PORTD, decoded back into the text shown on the tubes.
+*/
+
+#define SIM_F_CPU 16000000ULL
+
+#define SIM_US(us) ((uint64_t)(us) * (SIM_F_CPU / 1000000ULL))
+#define SIM_MS(ms) ((uint64_t)(ms) * (SIM_F_CPU / 1000ULL))
+
+// nominal CPU cost of HAL calls, roughly what the AVR core spends
+// lds/sts, in/out are 1 cycle but most accesses are read-modify-write
+#define SIM_COST_IO 2
+#define SIM_COST_MILLIS 32
+#define SIM_COST_MICROS 56
+#define SIM_COST_DIGITAL_WRITE 64
+#define SIM_COST_DIGITAL_READ 48
+#define SIM_COST_ANALOG_READ SIM_US(112)
+#define SIM_COST_EEPROM_WRITE SIM_US(3400)
+#define SIM_COST_WS2812_LED SIM_US(30)
+// clockless driver around the bits with interrupts off: color adjustment
+// before, the millis() correction (32 bit divisions) after
+#define SIM_COST_WS2812_SETUP SIM_US(35)
+#define SIM_COST_WS2812_TAIL SIM_US(95)
+
+enum
+{
+    SIM_INT0 = 1,
+    SIM_INT1,
+    SIM_PCINT0,
+    SIM_PCINT1,
+    SIM_PCINT2,
+    SIM_WDT,
+    SIM_TIMER2_COMPA,
+    SIM_TIMER2_COMPB,
+    SIM_TIMER2_OVF,
+    SIM_TIMER1_CAPT,
+    SIM_TIMER1_COMPA,
+    SIM_TIMER1_COMPB,
+    SIM_TIMER1_OVF,
+    SIM_TIMER0_COMPA,
+    SIM_TIMER0_COMPB,
+    SIM_TIMER0_OVF,
+    SIM_SPI_STC,
+    SIM_USART_RX,
+    SIM_USART_UDRE,
+    SIM_USART_TX,
+    SIM_ADC,
+    SIM_EE_READY,
+    SIM_ANALOG_COMP,
+    SIM_TWI,
+    SIM_SPM_READY,
+    SIM_VECTORS,
+};
+
+/***********************************
+* Clock and interrupts
+***********************************/
+
+void sim_init();
+uint64_t sim_now();
+/* CPU busy for `cycles`, interrupts are served when enabled */
+void sim_advance(uint64_t cycles);
+/* Runs the clock to the next interrupt, for sleep_cpu() */
+void sim_sleep();
+/* Calls `action` at virtual time `at` */
+void sim_at(uint64_t at, std::function<void()> action);
+void sim_raise(uint8_t vector);
+void sim_dispatch();
+void sim_attach_int(uint8_t interrupt, void (*handler)(), int mode);
+uint32_t sim_isr_count(uint8_t vector);
+
+/***********************************
+* Pins
+***********************************/
+
+/* Drives an input pin, raises pin change / external interrupts */
+void sim_set_input(uint8_t pin, bool level);
+/* Level the MCU sees on the pin */
+bool sim_pin_level(uint8_t pin);
+void sim_set_analog(uint8_t channel, uint16_t value);
+uint16_t sim_analog(uint8_t channel);
+
+/***********************************
+* Stimulus
+***********************************/
+
+/* Encoder detents from `at`, positive is clockwise */
+void sim_encoder_rotate(uint64_t at, int detents, uint32_t detent_us);
+void sim_button_press(uint64_t at, uint32_t hold_ms);
+
+/***********************************
+* Devices
+***********************************/
+
+/* Bytes arriving on the serial port from `at` on, back to back at the set baud rate */
+void sim_serial_input(uint64_t at, const std::string &bytes);
+
+void sim_rtc_set(uint8_t hour, uint8_t minute, uint8_t second);
+void sim_dht12_set(int16_t temperature10, uint16_t humidity10);
+#define SIM_EEPROM_SIZE 1024
+
+uint8_t *sim_eeprom();
+
+/***********************************
+* Observation
+***********************************/
+
+struct sim_scan_stats_t
+{
+    uint32_t latches;
+    uint32_t periods;
+    uint64_t period_sum;
+    uint64_t period_sq_sum;
+    uint32_t period_min;
+    uint32_t period_max;
+    // lit time per grid over the run, cycles
+    uint64_t on_cycles[5];
+};
+
+/* Text on the tubes, left to right, one char per tube */
+std::string sim_display_text();
+const sim_scan_stats_t *sim_scan_stats();
+void sim_scan_stats_reset();
+/* Called whenever the decoded text changes */
+void sim_on_display_change(void (*callback)(const std::string &text));
+/* Called with every byte the serial port has sent */
+void sim_on_serial_output(void (*callback)(uint8_t value));
+uint32_t sim_led_shows();
+
+#endif
@@ -0,0 +1,356 @@
+#include "sim.h"
+
+#include <chrono>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+
+/*
+* Native harness: runs setup() and loop() against the virtual MCU for a
+* span of virtual time and reports timing.
+*
+*   --seconds N          virtual run time (default 60)
+*   --time HH:MM:SS      DS3231 time at power on
+*   --temperature T      DHT12 temperature, degrees (default 21.5)
+*   --humidity H         DHT12 humidity, percent (default 40)
+*   --climate MS:T:H     DHT12 temperature and humidity from MS on
+*   --ldr [MS:]N         LDR reading 0..1023 (default 800), from MS on
+*   --rotate MS:N        N encoder detents at MS, negative turns left
+*   --press MS:HOLD      button press at MS held for HOLD ms
+*   --serial MS:TEXT     TEXT arrives on the serial port at MS, \xHH is a byte
+*   --eeprom FILE        EEPROM image, loaded if it exists and saved at the end
+*   --trace              print every change of the tubes
+*   --link               the serial port on stdin and stdout, for tools/iv6link.py:
+*                        virtual time follows the wall clock, the report goes
+*                        to stderr and without --seconds the run ends once
+*                        stdin is closed
+*/
+
+// the firmware gets this long to answer after stdin was closed
+#define LINK_DRAIN_MS 500
+
+struct stimulus_t
+{
+    uint64_t at;
+    uint64_t changed;
+};
+
+static bool trace;
+static bool linked;
+static FILE *report = stdout;
+static std::vector<stimulus_t> stimuli;
+static uint32_t serial_in;
+static uint32_t serial_out;
+
+static void on_display_change(const std::string &text)
+{
+    const uint64_t now = sim_now();
+
+    if (trace)
+        fprintf(report, "%10.3f ms  [%s]\n", now / (double)SIM_MS(1), text.c_str());
+
+    for (size_t i = 0; i < stimuli.size(); i++)
+    {
+        if (stimuli[i].changed == 0 && now >= stimuli[i].at)
+            stimuli[i].changed = now;
+    }
+}
+
+static void on_serial_output(uint8_t value)
+{
+    serial_out++;
+    if (linked)
+        putchar(value);
+}
+
+/* Paces virtual time to the wall clock and moves stdin to the serial port, false at its end */
+static bool link_service(std::chrono::steady_clock::time_point wall_start)
+{
+    fflush(stdout);
+
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    const double ahead = sim_now() / (double)SIM_F_CPU - wall;
+    if (ahead > 0.001)
+        usleep(ahead * 1e6);
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    timeval timeout = {0, 0};
+    if (select(STDIN_FILENO + 1, &fds, nullptr, nullptr, &timeout) <= 0)
+        return true;
+
+    char buffer[256];
+    const ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (length <= 0)
+        return false;
+
+    serial_in += length;
+    sim_serial_input(sim_now(), std::string(buffer, length));
+
+    return true;
+}
+
+/* C string with \xHH and \\ escapes to bytes */
+static std::string unescape(const char *text)
+{
+    std::string bytes;
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        unsigned value;
+        if (c[0] == '\\' && c[1] == 'x' && sscanf(c + 2, "%2x", &value) == 1)
+        {
+            bytes.push_back(value);
+            c += isxdigit(c[3]) ? 3 : 2;
+        }
+        else if (c[0] == '\\' && c[1] == '\\')
+        {
+            bytes.push_back('\\');
+            c++;
+        }
+        else
+        {
+            bytes.push_back(*c);
+        }
+    }
+
+    return bytes;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--seconds N] [--time HH:MM:SS] [--temperature T] [--humidity H]\n"
+            "          [--climate MS:T:H]... [--ldr [MS:]N]... [--rotate MS:N]...\n"
+            "          [--press MS:HOLD]... [--serial MS:TEXT]... [--eeprom FILE] [--trace]\n"
+            "          [--link]\n",
+            name);
+    exit(2);
+}
+
+static void report_isr(const char *name, uint8_t vector, double seconds)
+{
+    const uint32_t count = sim_isr_count(vector);
+    if (count != 0)
+        fprintf(report, "  %-14s %10u  %9.1f/s\n", name, count, count / seconds);
+}
+
+static void eeprom_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+        return;
+
+    fread(sim_eeprom(), 1, SIM_EEPROM_SIZE, file);
+    fclose(file);
+}
+
+static void eeprom_save(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        perror(path);
+        return;
+    }
+
+    fwrite(sim_eeprom(), 1, SIM_EEPROM_SIZE, file);
+    fclose(file);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 60;
+    bool seconds_set = false;
+    int hour = 12, minute = 0, second = 0;
+    double temperature = 21.5, humidity = 40;
+    int ldr = 800;
+    const char *eeprom = nullptr;
+
+    sim_init();
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(option, "--trace") == 0)
+        {
+            trace = true;
+            continue;
+        }
+        if (strcmp(option, "--link") == 0)
+        {
+            linked = true;
+            report = stderr;
+            continue;
+        }
+
+        if (value == nullptr)
+            usage(argv[0]);
+        i++;
+
+        if (strcmp(option, "--seconds") == 0)
+        {
+            seconds = atof(value);
+            seconds_set = true;
+        }
+        else if (strcmp(option, "--time") == 0)
+        {
+            if (sscanf(value, "%d:%d:%d", &hour, &minute, &second) < 2)
+                usage(argv[0]);
+        }
+        else if (strcmp(option, "--temperature") == 0)
+        {
+            temperature = atof(value);
+        }
+        else if (strcmp(option, "--humidity") == 0)
+        {
+            humidity = atof(value);
+        }
+        else if (strcmp(option, "--climate") == 0)
+        {
+            unsigned ms;
+            double t, h;
+            if (sscanf(value, "%u:%lf:%lf", &ms, &t, &h) != 3)
+                usage(argv[0]);
+
+            const int16_t t10 = lround(t * 10);
+            const uint16_t h10 = lround(h * 10);
+            sim_at(SIM_MS(ms), [t10, h10]() { sim_dht12_set(t10, h10); });
+        }
+        else if (strcmp(option, "--ldr") == 0)
+        {
+            unsigned ms;
+            int reading;
+            if (sscanf(value, "%u:%d", &ms, &reading) == 2)
+                sim_at(SIM_MS(ms), [reading]() { sim_set_analog(2, reading); });
+            else
+                ldr = atoi(value);
+        }
+        else if (strcmp(option, "--rotate") == 0)
+        {
+            unsigned ms;
+            int detents;
+            if (sscanf(value, "%u:%d", &ms, &detents) != 2)
+                usage(argv[0]);
+
+            sim_encoder_rotate(SIM_MS(ms), detents, 20000);
+            stimuli.push_back({SIM_MS(ms), 0});
+        }
+        else if (strcmp(option, "--press") == 0)
+        {
+            unsigned ms, hold;
+            if (sscanf(value, "%u:%u", &ms, &hold) != 2)
+                usage(argv[0]);
+
+            sim_button_press(SIM_MS(ms), hold);
+            stimuli.push_back({SIM_MS(ms), 0});
+        }
+        else if (strcmp(option, "--serial") == 0)
+        {
+            const char *text = strchr(value, ':');
+            if (text == nullptr)
+                usage(argv[0]);
+
+            const std::string bytes = unescape(text + 1);
+            serial_in += bytes.size();
+            sim_serial_input(SIM_MS(atoi(value)), bytes);
+        }
+        else if (strcmp(option, "--eeprom") == 0)
+        {
+            eeprom = value;
+            eeprom_load(eeprom);
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    sim_rtc_set(hour, minute, second);
+    sim_dht12_set(lround(temperature * 10), lround(humidity * 10));
+    sim_set_analog(2, ldr);
+    sim_on_display_change(on_display_change);
+    sim_on_serial_output(on_serial_output);
+
+    uint64_t end = linked && !seconds_set ? UINT64_MAX : SIM_MS((uint64_t)(seconds * 1000));
+    bool link_open = linked;
+    const auto wall_start = std::chrono::steady_clock::now();
+
+    setup();
+
+    uint32_t loops = 0;
+    while (sim_now() < end)
+    {
+        loop();
+        loops++;
+
+        if (link_open && !link_service(wall_start))
+        {
+            link_open = false;
+            if (!seconds_set)
+                end = sim_now() + SIM_MS(LINK_DRAIN_MS);
+        }
+    }
+
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    const double virtual_seconds = sim_now() / (double)SIM_F_CPU;
+
+    fprintf(report, "virtual %.3f s, wall %.3f s (%.0fx), %u loop() calls\n", virtual_seconds, wall,
+           wall > 0 ? virtual_seconds / wall : 0.0, loops);
+    fprintf(report, "display [%s]\n", sim_display_text().c_str());
+
+    fprintf(report, "interrupts:\n");
+    report_isr("INT0", SIM_INT0, virtual_seconds);
+    report_isr("PCINT0", SIM_PCINT0, virtual_seconds);
+    report_isr("PCINT2", SIM_PCINT2, virtual_seconds);
+    report_isr("TIMER2_COMPA", SIM_TIMER2_COMPA, virtual_seconds);
+    report_isr("TIMER2_COMPB", SIM_TIMER2_COMPB, virtual_seconds);
+    report_isr("TIMER0_OVF", SIM_TIMER0_OVF, virtual_seconds);
+    report_isr("TWI", SIM_TWI, virtual_seconds);
+    report_isr("USART_RX", SIM_USART_RX, virtual_seconds);
+    report_isr("USART_UDRE", SIM_USART_UDRE, virtual_seconds);
+    report_isr("ADC", SIM_ADC, virtual_seconds);
+    report_isr("EE_READY", SIM_EE_READY, virtual_seconds);
+
+    const sim_scan_stats_t *scan = sim_scan_stats();
+    if (scan->periods != 0)
+    {
+        const double mean = scan->period_sum / (double)scan->periods;
+        const double variance = scan->period_sq_sum / (double)scan->periods - mean * mean;
+
+        fprintf(report, "scan period: min %.2f us, avg %.2f us, max %.2f us, stddev %.3f us\n",
+               scan->period_min / 16.0, mean / 16.0, scan->period_max / 16.0,
+               sqrt(variance > 0 ? variance : 0) / 16.0);
+
+        fprintf(report, "grid duty:");
+        for (int grid = 4; grid >= 0; grid--)
+            fprintf(report, " %.1f%%", 100.0 * scan->on_cycles[grid] / sim_now());
+        fprintf(report, "\n");
+    }
+
+    fprintf(report, "led frames: %u\n", sim_led_shows());
+    fprintf(report, "serial: %u bytes in, %u bytes out\n", serial_in, serial_out);
+
+    for (size_t i = 0; i < stimuli.size(); i++)
+    {
+        if (stimuli[i].changed != 0)
+            fprintf(report, "input at %.0f ms: display changed after %.3f ms\n", stimuli[i].at / (double)SIM_MS(1),
+                   (stimuli[i].changed - stimuli[i].at) / (double)SIM_MS(1));
+        else
+            fprintf(report, "input at %.0f ms: no display change\n", stimuli[i].at / (double)SIM_MS(1));
+    }
+
+    if (eeprom != nullptr)
+        eeprom_save(eeprom);
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+#ifndef IV6CLOCK_MOTHERBOARD_ANIMATION_H
+#define IV6CLOCK_MOTHERBOARD_ANIMATION_H
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "display.h"
+
+/*
+* Frame-scheduled display animations.
+*
+* A keyframe is a target frame plus the effect used to reach it from
+* whatever is on the display when the keyframe starts. animation_tick() is
+* called from loop() and plays at most one step per call once the step
+* time has elapsed, so nothing here ever blocks. After the last step the
+* target is held for hold_ms before the next keyframe is started.
+*
+* Scrolls and wipes take one step per tube. The crossfade dims the old
+* frame down through the display levels, swaps the symbols and brings the
+* new frame back up, ANIMATION_FADE_STEPS each way.
+*
+* While animation_busy() the animation owns the display and activities
+* must not be rendered.
+*/
+
+enum
+{
+    ANIMATION_NONE,
+    ANIMATION_SCROLL_LEFT,
+    ANIMATION_SCROLL_RIGHT,
+    ANIMATION_WIPE,
+    ANIMATION_CROSSFADE,
+};
+
+#define ANIMATION_QUEUE_SIZE 4
+#define ANIMATION_STEP_MS 60
+#define ANIMATION_FADE_STEPS 8
+
+struct keyframe_t
+{
+    uint8_t symbols[DISPLAY_DIGITS];
+    uint8_t effect;
+    uint16_t step_ms;
+    uint16_t hold_ms;
+};
+
+struct animation_t
+{
+    keyframe_t queue[ANIMATION_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+
+    uint8_t from[DISPLAY_DIGITS];
+    uint8_t step;
+    uint8_t active;
+    unsigned long timer;
+};
+
+animation_t animation;
+
+static inline bool animation_busy()
+{
+    return animation.active || animation.count > 0;
+}
+
+static bool animation_queue(const uint8_t *symbols, uint8_t effect, uint16_t step_ms, uint16_t hold_ms)
+{
+    if (animation.count >= ANIMATION_QUEUE_SIZE)
+        return false;
+
+    keyframe_t *keyframe = &animation.queue[(animation.head + animation.count) % ANIMATION_QUEUE_SIZE];
+    memcpy(keyframe->symbols, symbols, DISPLAY_DIGITS);
+    keyframe->effect = effect;
+    keyframe->step_ms = step_ms;
+    keyframe->hold_ms = hold_ms;
+
+    animation.count++;
+
+    return true;
+}
+
+static void animation_clear()
+{
+    if (animation.active)
+        display_set_levels(DISPLAY_LEVEL_MAX);
+
+    animation.count = 0;
+    animation.active = 0;
+}
+
+static uint8_t animation_steps(uint8_t effect)
+{
+    switch (effect)
+    {
+    case ANIMATION_NONE:
+        return 1;
+    case ANIMATION_CROSSFADE:
+        return 2 * ANIMATION_FADE_STEPS;
+    default:
+        return DISPLAY_DIGITS;
+    }
+}
+
+/* Level of the crossfade step, the symbols are swapped at the darkest step */
+static uint8_t animation_fade_level(uint8_t step)
+{
+    const uint8_t fade_step = DISPLAY_LEVELS / ANIMATION_FADE_STEPS;
+
+    if (step <= ANIMATION_FADE_STEPS)
+        return DISPLAY_LEVEL_MAX - (step * fade_step < DISPLAY_LEVEL_MAX ? step * fade_step : DISPLAY_LEVEL_MAX);
+
+    return (step - ANIMATION_FADE_STEPS) * fade_step - 1;
+}
+
+/* Composes step `step` (1..animation_steps()) of the keyframe into the display */
+static void animation_compose(const keyframe_t *keyframe, uint8_t step)
+{
+    const uint8_t *to = keyframe->symbols;
+
+    if (keyframe->effect == ANIMATION_CROSSFADE)
+        display_set_levels(animation_fade_level(step));
+
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; i++)
+    {
+        uint8_t symbol;
+
+        switch (keyframe->effect)
+        {
+        case ANIMATION_SCROLL_LEFT:
+        {
+            // [from][to] moving left
+            const uint8_t n = i + step;
+            symbol = n < DISPLAY_DIGITS ? animation.from[n] : to[n - DISPLAY_DIGITS];
+            break;
+        }
+        case ANIMATION_SCROLL_RIGHT:
+        {
+            // [to][from] moving right
+            const uint8_t n = i + DISPLAY_DIGITS - step;
+            symbol = n < DISPLAY_DIGITS ? to[n] : animation.from[n - DISPLAY_DIGITS];
+            break;
+        }
+        case ANIMATION_WIPE:
+            symbol = i < step ? to[i] : animation.from[i];
+            break;
+        case ANIMATION_CROSSFADE:
+            symbol = step < ANIMATION_FADE_STEPS ? animation.from[i] : to[i];
+            break;
+        default:
+            symbol = to[i];
+        }
+
+        display_set(i, symbol);
+    }
+
+    display_commit();
+}
+
+static void animation_tick()
+{
+    if (!animation.active)
+    {
+        if (animation.count == 0)
+            return;
+
+        memcpy(animation.from, display.symbols, DISPLAY_DIGITS);
+        animation.step = 0;
+        animation.active = 1;
+        animation.timer = millis() - animation.queue[animation.head].step_ms;
+    }
+
+    const keyframe_t *keyframe = &animation.queue[animation.head];
+
+    if (animation.step < animation_steps(keyframe->effect))
+    {
+        if (millis() - animation.timer < keyframe->step_ms)
+            return;
+
+        animation.timer = millis();
+        animation.step++;
+        animation_compose(keyframe, animation.step);
+        return;
+    }
+
+    if (millis() - animation.timer < keyframe->hold_ms)
+        return;
+
+    animation.head = (animation.head + 1) % ANIMATION_QUEUE_SIZE;
+    animation.count--;
+    animation.active = 0;
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_ANIMATION_H
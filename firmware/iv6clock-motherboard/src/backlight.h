@@ -0,0 +1,204 @@
+#ifndef IV6CLOCK_MOTHERBOARD_BACKLIGHT_H
+#define IV6CLOCK_MOTHERBOARD_BACKLIGHT_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+#include "display.h"
+
+/*
+* WS2812 backlight engine.
+*
+* The strip is described by a base color, an effect and a value that
+* fades towards a target (the LDR switches between the day and night
+* values). backlight_tick() advances the fade and the effect phase in 8.8
+* fixed point, recomputes only when one of its inputs moved, writes only
+* the LEDs whose color changed and sends a frame only if one did.
+* A steady strip costs a few compares per tick and never blocks the scan
+* ISR. A frame keeps interrupts off for up to BACKLIGHT_SHOW_US, it is
+* started in a scan gap (display_sync()) so it never delays a grid
+* transition. The frame goes straight to the controller's showLeds(),
+* FastLED.show() would add its frame rate and power bookkeeping to the
+* gap.
+*
+* Effects
+*   BACKLIGHT_SOLID     every LED in the base color
+*   BACKLIGHT_GRADIENT  hue spread over `span` hue steps along the strip
+*   BACKLIGHT_BREATHE   value swings between BACKLIGHT_BREATHE_FLOOR and
+*                       full once every `span` * 256 ms
+*
+* Breathe is the only effect that keeps changing, and every frame may keep
+* the CPU awake in display_sync() for up to a scan slot. Its frames are
+* rate limited to BACKLIGHT_BREATHE_FRAME_TICKS, still smooth to the eye.
+*/
+
+#define BACKLIGHT_LEDS 5
+#define BACKLIGHT_TICK_MS 20
+#define BACKLIGHT_BREATHE_FLOOR 96
+// breathe frames at most every 3 ticks, about 16 per second
+#define BACKLIGHT_BREATHE_FRAME_TICKS 3
+/*
+* Worst case of showLeds() on the AVR clockless driver at 16 MHz, all with
+* interrupts off: about 35 us for the color adjustment (three 32 bit
+* multiplies) and the pixel setup, 24 bits at 1.25 us per LED, then about
+* 95 us for the millis() correction (two 32 bit divisions). Estimated
+* from the driver's code paths and rounded up, the native sim charges the
+* same. No latch wait, frames are BACKLIGHT_TICK_MS apart.
+*/
+#define BACKLIGHT_DRIVER_US 160
+#define BACKLIGHT_SHOW_US (BACKLIGHT_LEDS * 30 + BACKLIGHT_DRIVER_US)
+
+enum
+{
+    BACKLIGHT_SOLID,
+    BACKLIGHT_GRADIENT,
+    BACKLIGHT_BREATHE,
+
+    BACKLIGHT_EFFECTS
+};
+
+struct backlight_t
+{
+    CRGB leds[BACKLIGHT_LEDS];
+
+    uint8_t effect;
+    uint8_t span;
+    uint8_t hue;
+    uint8_t saturation;
+
+    // 8.8 fixed point
+    uint16_t value;
+    uint16_t value_step;
+    uint8_t value_target;
+    uint16_t phase;
+
+    // value of the frame in leds[], stale after color or effect changes
+    uint8_t frame_value;
+    uint8_t frame_ticks;
+    uint8_t stale;
+};
+
+backlight_t backlight;
+
+static void backlight_init(uint8_t hue, uint8_t saturation, uint8_t value)
+{
+    backlight.effect = BACKLIGHT_SOLID;
+    backlight.hue = hue;
+    backlight.saturation = saturation;
+    backlight.value = (uint16_t)value << 8;
+    backlight.value_target = value;
+    backlight.stale = 1;
+}
+
+static void backlight_set_color(uint8_t hue, uint8_t saturation)
+{
+    if (hue == backlight.hue && saturation == backlight.saturation)
+        return;
+
+    backlight.hue = hue;
+    backlight.saturation = saturation;
+    backlight.stale = 1;
+}
+
+static void backlight_set_effect(uint8_t effect, uint8_t span)
+{
+    if (effect == backlight.effect && span == backlight.span)
+        return;
+
+    backlight.effect = effect;
+    backlight.span = span;
+    backlight.phase = 0;
+    backlight.stale = 1;
+}
+
+/* Fades the value to `value` over `ms`, 0 switches at once */
+static void backlight_fade_to(uint8_t value, uint16_t ms)
+{
+    const uint16_t ticks = ms / BACKLIGHT_TICK_MS;
+    const uint16_t target = (uint16_t)value << 8;
+
+    backlight.value_target = value;
+
+    if (ticks == 0)
+    {
+        backlight.value = target;
+        backlight.value_step = 0;
+        backlight.stale = 1;
+        return;
+    }
+
+    const uint16_t distance = target > backlight.value ? target - backlight.value : backlight.value - target;
+    backlight.value_step = distance / ticks;
+    if (backlight.value_step == 0)
+        backlight.value_step = 1;
+}
+
+/* Moves the 8.8 value one step towards the target */
+static void backlight_fade_step()
+{
+    const uint16_t target = (uint16_t)backlight.value_target << 8;
+
+    if (backlight.value < target)
+        backlight.value = target - backlight.value > backlight.value_step ? backlight.value + backlight.value_step : target;
+    else if (backlight.value > target)
+        backlight.value = backlight.value - target > backlight.value_step ? backlight.value - backlight.value_step : target;
+}
+
+static void backlight_render(uint8_t value)
+{
+    // gradient hue walks along the strip in 8.8
+    const uint16_t hue_step = backlight.effect == BACKLIGHT_GRADIENT
+                                  ? ((uint16_t)backlight.span << 8) / (BACKLIGHT_LEDS - 1)
+                                  : 0;
+    uint16_t hue = (uint16_t)backlight.hue << 8;
+    bool dirty = false;
+
+    for (uint8_t i = 0; i < BACKLIGHT_LEDS; i++)
+    {
+        const CRGB color = CHSV(hue >> 8, backlight.saturation, value);
+        hue += hue_step;
+
+        if (color != backlight.leds[i])
+        {
+            backlight.leds[i] = color;
+            dirty = true;
+        }
+    }
+
+    if (!dirty)
+        return;
+
+    // the driver turns interrupts back on when the frame is out
+    display_sync(DISPLAY_US_TICKS(BACKLIGHT_SHOW_US));
+    FastLED[0].showLeds(FastLED.getBrightness());
+}
+
+static void backlight_tick()
+{
+    backlight_fade_step();
+
+    uint8_t value = backlight.value >> 8;
+
+    if (backlight.effect == BACKLIGHT_BREATHE && backlight.span != 0)
+    {
+        // one phase turn is 256 * span ms
+        backlight.phase += ((uint16_t)BACKLIGHT_TICK_MS << 8) / backlight.span;
+
+        const uint8_t swing = scale8(sin8(backlight.phase >> 8), 255 - BACKLIGHT_BREATHE_FLOOR);
+        value = scale8_video(value, BACKLIGHT_BREATHE_FLOOR + swing);
+
+        if (++backlight.frame_ticks < BACKLIGHT_BREATHE_FRAME_TICKS && !backlight.stale)
+            return;
+    }
+
+    if (!backlight.stale && value == backlight.frame_value)
+        return;
+
+    backlight.stale = 0;
+    backlight.frame_ticks = 0;
+    backlight.frame_value = value;
+
+    backlight_render(value);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_BACKLIGHT_H
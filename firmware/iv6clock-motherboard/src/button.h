@@ -0,0 +1,120 @@
+#ifndef IV6CLOCK_MOTHERBOARD_BUTTON_H
+#define IV6CLOCK_MOTHERBOARD_BUTTON_H
+
+#include <Arduino.h>
+
+#include "input.h"
+
+/*
+* Encoder push button on PD4, active high.
+*
+* button_sample() runs from the scan ISR every BUTTON_TICK_MS. The pin is
+* shifted into a history byte and the state flips only after
+* BUTTON_DEBOUNCE_MASK samples agree, so contact bounce never reaches the
+* gesture logic and nothing waits.
+*
+* Every debounced edge is an INPUT_PRESS or INPUT_RELEASE event, the
+* gestures follow them
+*   INPUT_CLICK         released before BUTTON_LONG_MS
+*   INPUT_DOUBLE_CLICK  pressed again within BUTTON_DOUBLE_MS of a click,
+*                       reported instead of the second INPUT_CLICK
+*   INPUT_LONG_PRESS    held for BUTTON_LONG_MS, the release is no click
+*   INPUT_REPEAT        every BUTTON_REPEAT_MS while held after that
+*/
+
+#define PIN_ENCODER_BTN PD4
+
+// one scan slot
+#define BUTTON_TICK_MS 2
+#define BUTTON_DEBOUNCE_MASK 0x0F
+#define BUTTON_LONG_MS 600
+#define BUTTON_REPEAT_MS 200
+#define BUTTON_DOUBLE_MS 300
+
+#define BUTTON_TICKS(ms) ((ms) / BUTTON_TICK_MS)
+#define BUTTON_IDLE 0xFFFF
+
+static_assert(BUTTON_TICKS(BUTTON_REPEAT_MS) <= 0xFF, "repeat countdown is 8 bit");
+
+struct button_t
+{
+    uint8_t history;
+    uint8_t pressed;
+    uint8_t second;
+    uint8_t long_sent;
+    uint8_t repeat;
+
+    // ticks since the button went down, and since the last click
+    uint16_t held;
+    uint16_t since_click;
+};
+
+button_t button = {/*history=*/0, /*pressed=*/0, /*second=*/0, /*long_sent=*/0, /*repeat=*/0, /*held=*/0,
+                   /*since_click=*/BUTTON_IDLE};
+
+static void button_init()
+{
+    DDRD &= ~_BV(PIN_ENCODER_BTN);
+}
+
+/* Called from the scan ISR every BUTTON_TICK_MS */
+static inline void button_sample()
+{
+    button.history = button.history << 1 | ((PIND >> PIN_ENCODER_BTN) & 1);
+    const uint8_t samples = button.history & BUTTON_DEBOUNCE_MASK;
+
+    if (button.since_click != BUTTON_IDLE)
+        button.since_click++;
+
+    if (!button.pressed)
+    {
+        if (samples != BUTTON_DEBOUNCE_MASK)
+            return;
+
+        button.pressed = 1;
+        button.held = 0;
+        button.long_sent = 0;
+        button.second = button.since_click < BUTTON_TICKS(BUTTON_DOUBLE_MS);
+        input_push(INPUT_PRESS);
+        return;
+    }
+
+    if (samples == 0)
+    {
+        button.pressed = 0;
+        input_push(INPUT_RELEASE);
+        if (button.long_sent)
+            return;
+
+        if (button.second)
+        {
+            input_push(INPUT_DOUBLE_CLICK);
+            button.since_click = BUTTON_IDLE;
+        }
+        else
+        {
+            input_push(INPUT_CLICK);
+            button.since_click = 0;
+        }
+        return;
+    }
+
+    // held stops at the long press, the repeat counts down from there
+    if (!button.long_sent)
+    {
+        if (++button.held < BUTTON_TICKS(BUTTON_LONG_MS))
+            return;
+
+        button.long_sent = 1;
+        button.repeat = BUTTON_TICKS(BUTTON_REPEAT_MS);
+        button.since_click = BUTTON_IDLE;
+        input_push(INPUT_LONG_PRESS);
+    }
+    else if (--button.repeat == 0)
+    {
+        button.repeat = BUTTON_TICKS(BUTTON_REPEAT_MS);
+        input_push(INPUT_REPEAT);
+    }
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_BUTTON_H
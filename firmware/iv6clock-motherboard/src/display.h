@@ -0,0 +1,211 @@
+#ifndef IV6CLOCK_MOTHERBOARD_DISPLAY_H
+#define IV6CLOCK_MOTHERBOARD_DISPLAY_H
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "iv6_n.h"
+#include "spsc_queue.h"
+
+/*
+* Double-buffered IV6 frame.
+*
+* Activities compose the frame symbol by symbol with display_set(),
+* positions are numbered left to right (0 is the leftmost tube), then
+* publish it with display_commit(). The commit encodes every position into
+* the inverted 16 bit shift register word of its grid, so the scan ISR
+* only indexes the front buffer.
+*
+* A committed frame is handed to the ISR through `pending` and adopted at
+* the start of a scan cycle, so one cycle never mixes two frames.
+*
+* Brightness
+*
+* Every grid is lit for DISPLAY_SCAN_TICKS Timer2 ticks (16 us each). A
+* grid below full level is blanked early by the Timer2 compare B match,
+* `ticks` holds that compare value per grid. The effective level of a
+* position is its own level scaled by the global brightness.
+*
+* Scan gaps
+*
+* Code that must run with interrupts off for a while (the WS2812 frame)
+* calls display_sync() first. It returns at a point where the next
+* compare match, start of a slot or early blank, is at least the given
+* number of ticks away, so no grid transition is delayed. After the
+* compare A match the gap runs to compare B (or the next slot at full
+* level), after compare B to the next slot. One of the two is always at
+* least half a slot long.
+*/
+
+#define DISPLAY_DIGITS 5
+#define DISPLAY_NO_FRAME 0xFF
+
+#define DISPLAY_LEVELS 16
+#define DISPLAY_LEVEL_MAX (DISPLAY_LEVELS - 1)
+
+// 2 ms slot at F_CPU / 256
+#define DISPLAY_SCAN_TICKS 125
+// compare B value that never matches, Timer2 is cleared at DISPLAY_SCAN_TICKS - 1
+#define DISPLAY_TICKS_FULL 0xFF
+#define DISPLAY_BLANK_WORD 0xFFFF
+
+// Timer2 ticks covering `us`, plus one for the counter resolution
+#define DISPLAY_US_TICKS(us) (((us) + 15) / 16 + 1)
+
+// on-time per level in Timer2 ticks, roughly perceptually even
+const uint8_t display_level_ticks[DISPLAY_LEVELS] PROGMEM = {
+    0, 1, 2, 4, 6, 9, 12, 16, 21, 27, 34, 43, 54, 68, 88, DISPLAY_TICKS_FULL,
+};
+
+struct display_frame_t
+{
+    uint16_t words[DISPLAY_DIGITS];
+    uint8_t ticks[DISPLAY_DIGITS];
+};
+
+struct display_t
+{
+    uint8_t symbols[DISPLAY_DIGITS];
+    uint8_t levels[DISPLAY_DIGITS];
+    uint8_t brightness;
+
+    display_frame_t frames[2];
+    volatile uint8_t front;
+    volatile uint8_t pending;
+
+    // Timer2 count of the next compare match the scan is waiting for
+    volatile uint8_t gap_end;
+};
+
+display_t display = {
+    /*symbols=*/{SYMBOL_EMPTY, SYMBOL_EMPTY, SYMBOL_EMPTY, SYMBOL_EMPTY, SYMBOL_EMPTY},
+    /*levels=*/{DISPLAY_LEVEL_MAX, DISPLAY_LEVEL_MAX, DISPLAY_LEVEL_MAX, DISPLAY_LEVEL_MAX, DISPLAY_LEVEL_MAX},
+    /*brightness=*/DISPLAY_LEVEL_MAX,
+    /*frames=*/{
+        {{DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD}, {0}},
+        {{DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD, DISPLAY_BLANK_WORD}, {0}},
+    },
+    /*front=*/0,
+    /*pending=*/DISPLAY_NO_FRAME,
+    /*gap_end=*/DISPLAY_SCAN_TICKS - 1,
+};
+
+static inline void display_set(uint8_t pos, uint8_t symbol)
+{
+    display.symbols[pos] = symbol;
+}
+
+static inline uint8_t display_get(uint8_t pos)
+{
+    return display.symbols[pos];
+}
+
+static inline void display_fill(uint8_t symbol)
+{
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; i++)
+        display.symbols[i] = symbol;
+}
+
+static inline void display_set_level(uint8_t pos, uint8_t level)
+{
+    display.levels[pos] = level;
+}
+
+static inline void display_set_levels(uint8_t level)
+{
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; i++)
+        display.levels[i] = level;
+}
+
+/* Global brightness, 0..DISPLAY_LEVEL_MAX, applied on the next commit */
+static inline void display_set_brightness(uint8_t level)
+{
+    display.brightness = level;
+}
+
+static void display_commit()
+{
+    // the ISR can not adopt a buffer while it is being written
+    display.pending = DISPLAY_NO_FRAME;
+    SPSC_BARRIER();
+
+    const uint8_t back = display.front ^ 1;
+    display_frame_t *frame = &display.frames[back];
+
+    // grid 0 is the rightmost tube
+    for (uint8_t grid = 0; grid < DISPLAY_DIGITS; grid++)
+    {
+        const uint8_t pos = DISPLAY_DIGITS - 1 - grid;
+        const uint8_t symbol = display.symbols[pos];
+        const uint8_t level = (display.levels[pos] * (display.brightness + 1)) / DISPLAY_LEVELS;
+
+        if (level == 0)
+        {
+            frame->words[grid] = DISPLAY_BLANK_WORD;
+            frame->ticks[grid] = DISPLAY_TICKS_FULL;
+            continue;
+        }
+
+        frame->words[grid] = (uint16_t) ~(IV6_symbol_word(symbol) | IV6_grid_word(grid));
+        frame->ticks[grid] = pgm_read_byte(&display_level_ticks[level]);
+    }
+
+    // the frame stores are plain, they must not sink below the handoff
+    SPSC_BARRIER();
+    display.pending = back;
+}
+
+/* Called from the scan ISR, returns the frame to show on the grid */
+static inline const display_frame_t *display_scan_frame(uint8_t grid)
+{
+    if (grid == 0 && display.pending != DISPLAY_NO_FRAME)
+    {
+        display.front = display.pending;
+        display.pending = DISPLAY_NO_FRAME;
+    }
+
+    return &display.frames[display.front];
+}
+
+/* Called from the scan ISR after a slot started with compare B at `ticks` */
+static inline void display_scan_started(uint8_t ticks)
+{
+    display.gap_end = ticks < DISPLAY_SCAN_TICKS ? ticks : DISPLAY_SCAN_TICKS - 1;
+}
+
+/* Called from the compare B ISR once the grid is blanked */
+static inline void display_scan_blanked()
+{
+    display.gap_end = DISPLAY_SCAN_TICKS - 1;
+}
+
+/*
+* Waits for a scan gap of at least `ticks` and returns with interrupts
+* disabled, restore the returned SREG when done. Must be called with
+* interrupts enabled, at most one slot passes before a gap comes up.
+*/
+static uint8_t display_sync(uint8_t ticks)
+{
+    const uint8_t sreg = SREG;
+
+    for (;;)
+    {
+        cli();
+
+        // compare A is due at the top count, a match that is still pending
+        // moved the gap already, the counter is read first so neither slips
+        // in between
+        const uint8_t count = TCNT2;
+        if (count < DISPLAY_SCAN_TICKS - 1 && !(TIFR2 & (_BV(OCF2A) | _BV(OCF2B))) &&
+            display.gap_end > count && display.gap_end - count >= ticks)
+        {
+            return sreg;
+        }
+
+        SREG = sreg;
+    }
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_DISPLAY_H
@@ -0,0 +1,83 @@
+#ifndef IV6CLOCK_MOTHERBOARD_EEPROM_WRITER_H
+#define IV6CLOCK_MOTHERBOARD_EEPROM_WRITER_H
+
+#include <Arduino.h>
+
+/*
+* Background EEPROM writes.
+*
+* One block at a time is programmed cell by cell from the EE_READY
+* interrupt, eeprom_writer_ready() runs from EE_READY_vect. Nothing waits
+* the 3.4 ms of a cell and cells that already hold their value are not
+* written at all. A block is either copied from `data`, which must stay
+* untouched until the writer is idle again, or filled with one value.
+*
+* The writer has no queue, eeprom_writer_start() refuses a block while
+* another one is written and the caller tries again later.
+*/
+
+struct eeprom_writer_t
+{
+    // nullptr fills with `fill`
+    const uint8_t *data;
+    uint8_t fill;
+    uint16_t address;
+    uint8_t length;
+    volatile uint8_t written;
+};
+
+eeprom_writer_t eeprom_writer;
+
+static inline bool eeprom_writer_busy()
+{
+    return eeprom_writer.written < eeprom_writer.length;
+}
+
+/* No block and no cell in progress, eeprom_read_*() is safe */
+static inline bool eeprom_writer_idle()
+{
+    return !(EECR & (_BV(EERIE) | _BV(EEPE)));
+}
+
+/* Starts writing `length` bytes at `address`, false while another block is written */
+static bool eeprom_writer_start(uint16_t address, const uint8_t *data, uint8_t length, uint8_t fill = 0xFF)
+{
+    if (eeprom_writer_busy())
+        return false;
+
+    eeprom_writer.data = data;
+    eeprom_writer.fill = fill;
+    eeprom_writer.address = address;
+    eeprom_writer.written = 0;
+    eeprom_writer.length = length;
+
+    // EE_READY fires right away while no write is running
+    EECR |= _BV(EERIE);
+
+    return true;
+}
+
+/* Called from EE_READY_vect, programs the next cell that differs */
+static void eeprom_writer_ready()
+{
+    while (eeprom_writer.written < eeprom_writer.length)
+    {
+        const uint8_t value =
+            eeprom_writer.data != nullptr ? eeprom_writer.data[eeprom_writer.written] : eeprom_writer.fill;
+        EEAR = eeprom_writer.address + eeprom_writer.written;
+        eeprom_writer.written++;
+
+        EECR |= _BV(EERE);
+        if (EEDR == value)
+            continue;
+
+        EEDR = value;
+        EECR |= _BV(EEMPE);
+        EECR |= _BV(EEPE);
+        return;
+    }
+
+    EECR &= ~_BV(EERIE);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_EEPROM_WRITER_H
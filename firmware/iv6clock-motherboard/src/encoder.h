@@ -0,0 +1,110 @@
+#ifndef IV6CLOCK_MOTHERBOARD_ENCODER_H
+#define IV6CLOCK_MOTHERBOARD_ENCODER_H
+
+#include <Arduino.h>
+
+#include "input.h"
+
+/*
+* Quadrature encoder on PD2 (A) and PD3 (B).
+*
+* Both pins raise PCINT2, encoder_pin_change() is called from that ISR
+* and looks the (previous, current) pin pair up in a gray code table, so
+* every valid transition counts a quarter step in its direction and
+* bounces cancel out. A detent is counted when the contacts come back to
+* rest (A = B = 1) at least half a cycle away from where they left it.
+*
+* Every detent is an INPUT_ROTATE event, a fast spin loses nothing. Its
+* weight grows as the time since the previous detent shrinks, spinning
+* quickly moves values by up to ENCODER_ACCEL_MAX per detent.
+*/
+
+#define PIN_ENCODER_A PD2
+#define PIN_ENCODER_B PD3
+
+#define ENCODER_REST 0x03
+
+// a detent faster than `ms` after the previous one counts `steps`
+#define ENCODER_ACCEL_LEVELS 3
+#define ENCODER_ACCEL_MAX 8
+
+struct encoder_accel_t
+{
+    uint8_t ms;
+    uint8_t steps;
+};
+
+const encoder_accel_t encoder_accel[ENCODER_ACCEL_LEVELS] PROGMEM = {
+    {/*ms=*/20, /*steps=*/ENCODER_ACCEL_MAX},
+    {/*ms=*/40, /*steps=*/4},
+    {/*ms=*/80, /*steps=*/2},
+};
+
+// quarter steps of a transition, index is previous << 2 | current, BA bits
+// clockwise runs 11 -> 01 -> 00 -> 10 -> 11
+const int8_t encoder_transitions[16] PROGMEM = {
+    0, -1, 1, 0,
+    1, 0, 0, -1,
+    -1, 0, 0, 1,
+    0, 1, -1, 0,
+};
+
+struct encoder_t
+{
+    uint8_t pins;
+    int8_t quarters;
+    uint16_t detent_ms;
+};
+
+encoder_t encoder = {/*pins=*/ENCODER_REST};
+
+static void encoder_init()
+{
+    DDRD &= ~(_BV(PIN_ENCODER_A) | _BV(PIN_ENCODER_B));
+
+    encoder.pins = (PIND >> PIN_ENCODER_A) & 0x03;
+
+    cli();
+    PCICR |= 1u << PCIE2;
+    PCMSK2 |= (1u << PCINT18) | (1u << PCINT19);
+    sei();
+}
+
+/* Called from PCINT2_vect */
+static void encoder_pin_change()
+{
+    const uint8_t pins = (PIND >> PIN_ENCODER_A) & 0x03;
+    if (pins == encoder.pins)
+        return;
+
+    encoder.quarters += (int8_t)pgm_read_byte(&encoder_transitions[encoder.pins << 2 | pins]);
+    encoder.pins = pins;
+
+    if (pins != ENCODER_REST)
+        return;
+
+    // a full cycle is four quarters, two still tell the direction
+    const int8_t direction = encoder.quarters >= 2 ? 1 : (encoder.quarters <= -2 ? -1 : 0);
+    encoder.quarters = 0;
+
+    if (direction == 0)
+        return;
+
+    const uint16_t now = millis();
+    const uint16_t elapsed = now - encoder.detent_ms;
+    encoder.detent_ms = now;
+
+    uint8_t weight = 1;
+    for (uint8_t i = 0; i < ENCODER_ACCEL_LEVELS; i++)
+    {
+        if (elapsed < pgm_read_byte(&encoder_accel[i].ms))
+        {
+            weight = pgm_read_byte(&encoder_accel[i].steps);
+            break;
+        }
+    }
+
+    input_push(INPUT_ROTATE, direction, weight);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_ENCODER_H
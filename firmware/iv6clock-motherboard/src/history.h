@@ -0,0 +1,473 @@
+#ifndef IV6CLOCK_MOTHERBOARD_HISTORY_H
+#define IV6CLOCK_MOTHERBOARD_HISTORY_H
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+#include "eeprom_writer.h"
+#include "rtc.h"
+#include "scheduler.h"
+
+/*
+* 24 hours of temperature and humidity.
+*
+* history_add() sums every sensor reading into the open five minute slot
+* of the day. The first reading in the next slot closes it, the average
+* is packed into one word
+*
+*   bits 15..7  temperature + 10.0 C in 0.1 C, -9.9 .. 40.9 C
+*   bits 6..0   relative humidity in %
+*
+* and stored at its slot in a ring of HISTORY_SLOTS words in EEPROM from
+* HISTORY_BASE, followed by HISTORY_HEAD in the slot after it. Both go
+* through the eeprom_writer, every cell is written twice a day. After a
+* power cut the slots from the head up to the current one hold the day
+* before, they are erased and left out. A cut of a day or more can not be
+* told from a shorter one. Slots skipped while running, when the time is
+* set or no reading came for a whole slot, are the same: closing a slot
+* erases the ones since the previous sample, the old head among them.
+* Setting the time back skips most of the day.
+*
+* The first reading once the time is known starts reading the ring back,
+* HISTORY_LOAD_SLOTS words per run of history_flush() and only while the
+* writer is idle, readings are dropped until it is done.
+*
+* Aggregates
+*
+* The SRAM keeps one bucket per hour of the day with the sums and the
+* extremes of its samples. A sample updates its bucket and the 24 hour
+* extremes in O(1). The first sample of an hour empties that hour's
+* bucket, a day old by now, and recomputes the extremes from the 24
+* buckets, once every HISTORY_SLOTS_PER_HOUR samples. The trend is the
+* average of the current hour against the one HISTORY_TREND_HOURS before.
+*/
+
+#define HISTORY_BASE 0x100
+#define HISTORY_SLOT_MINUTES 5
+#define HISTORY_HOURS 24
+#define HISTORY_SLOTS_PER_HOUR (60 / HISTORY_SLOT_MINUTES)
+#define HISTORY_SLOTS (HISTORY_HOURS * HISTORY_SLOTS_PER_HOUR)
+#define HISTORY_TREND_HOURS 3
+// history_trend() flags
+#define HISTORY_TREND_TEMPERATURE 0x01
+#define HISTORY_TREND_HUMIDITY 0x02
+
+// readings summed into one slot at most, the rest are dropped
+#define HISTORY_READINGS_MAX 60
+#define HISTORY_RETRY_MS 50
+// erased slots per eeprom_writer block
+#define HISTORY_ERASE_SLOTS 64
+// ring words read per history_flush() run while loading
+#define HISTORY_LOAD_SLOTS 32
+
+// temperature codes 1..509 hold -9.9 .. 40.9 C, the DHT12 reads -20 .. 60 C,
+// averages at or beyond the ends are stored as the end codes and shown as ---
+#define HISTORY_TEMPERATURE_BIAS 100
+#define HISTORY_TEMPERATURE_BELOW 0
+#define HISTORY_TEMPERATURE_ABOVE 510
+#define HISTORY_HUMIDITY_MAX 100
+
+// temperature code 511 marks words that are no sample
+#define HISTORY_SAMPLE_END 0xFF80
+#define HISTORY_EMPTY 0xFFFF
+#define HISTORY_HEAD 0xFFFE
+#define HISTORY_NONE 0xFFFF
+
+static_assert(HISTORY_BASE + HISTORY_SLOTS * 2 <= E2END + 1, "history does not fit the EEPROM");
+
+enum
+{
+    HISTORY_WRITE_SAMPLE = 1 << 0,
+    HISTORY_WRITE_HEAD = 1 << 1,
+    // the ring is read back in two passes
+    HISTORY_FIND_HEAD = 1 << 2,
+    HISTORY_READ = 1 << 3,
+};
+
+#define HISTORY_LOADING (HISTORY_FIND_HEAD | HISTORY_READ)
+
+struct history_hour_t
+{
+    // temperature codes and humidity %
+    uint16_t temperature_sum;
+    uint16_t humidity_sum;
+    uint16_t temperature_min;
+    uint16_t temperature_max;
+    uint8_t humidity_min;
+    uint8_t humidity_max;
+    uint8_t count;
+};
+
+struct history_t
+{
+    history_hour_t hours[HISTORY_HOURS];
+
+    // over the 24 hours
+    uint16_t samples;
+    uint16_t temperature_min;
+    uint16_t temperature_max;
+    uint8_t humidity_min;
+    uint8_t humidity_max;
+
+    // hour of the newest sample
+    uint8_t hour;
+
+    // open slot, HISTORY_NONE before the first reading
+    uint16_t slot;
+    uint8_t readings;
+    long temperature_sum;
+    uint16_t humidity_sum;
+
+    // slot after the newest sample, where the head is
+    uint16_t next;
+
+    // next word of the pass
+    uint16_t load_index;
+    uint16_t load_head;
+
+    // EEPROM work left for history_flush()
+    uint8_t pending;
+    uint16_t sample;
+    uint16_t sample_slot;
+    uint16_t erase_slot;
+    uint16_t erase_count;
+
+    task_t *task;
+};
+
+history_t history;
+
+const uint16_t history_head = HISTORY_HEAD;
+
+/* `task` is a registered one-shot task running history_flush() */
+static void history_init(task_t *task)
+{
+    history.task = task;
+    history.slot = HISTORY_NONE;
+}
+
+static inline uint16_t history_address(uint16_t slot)
+{
+    return HISTORY_BASE + slot * 2;
+}
+
+static inline uint16_t history_slot_of(const rtc_time_t &time)
+{
+    return (time.hour * 60 + time.minute) / HISTORY_SLOT_MINUTES;
+}
+
+static inline uint16_t history_temperature_code(uint16_t sample)
+{
+    return sample >> 7;
+}
+
+static inline uint8_t history_humidity(uint16_t sample)
+{
+    return sample & 0x7F;
+}
+
+/* 0.1 C of a temperature code */
+static inline int16_t history_temperature(uint16_t code)
+{
+    return (int16_t)code - HISTORY_TEMPERATURE_BIAS;
+}
+
+/* Whether a temperature code holds a value, not one of the out of range ends */
+static inline bool history_temperature_valid(uint16_t code)
+{
+    return code != HISTORY_TEMPERATURE_BELOW && code != HISTORY_TEMPERATURE_ABOVE;
+}
+
+static uint16_t history_pack(int16_t temperature10, uint16_t humidity10)
+{
+    const int16_t code = temperature10 + HISTORY_TEMPERATURE_BIAS;
+    const uint16_t humidity = (humidity10 + 5) / 10;
+
+    return (uint16_t)constrain(code, HISTORY_TEMPERATURE_BELOW, HISTORY_TEMPERATURE_ABOVE) << 7 |
+           (humidity > HISTORY_HUMIDITY_MAX ? HISTORY_HUMIDITY_MAX : humidity);
+}
+
+static void history_extremes_add(const history_hour_t *hour)
+{
+    if (history.samples == 0 || hour->temperature_min < history.temperature_min)
+        history.temperature_min = hour->temperature_min;
+    if (history.samples == 0 || hour->temperature_max > history.temperature_max)
+        history.temperature_max = hour->temperature_max;
+    if (history.samples == 0 || hour->humidity_min < history.humidity_min)
+        history.humidity_min = hour->humidity_min;
+    if (history.samples == 0 || hour->humidity_max > history.humidity_max)
+        history.humidity_max = hour->humidity_max;
+
+    history.samples += hour->count;
+}
+
+static void history_extremes_update()
+{
+    history.samples = 0;
+    for (uint8_t i = 0; i < HISTORY_HOURS; i++)
+    {
+        if (history.hours[i].count != 0)
+            history_extremes_add(&history.hours[i]);
+    }
+}
+
+static void history_bucket_add(history_hour_t *hour, uint16_t sample)
+{
+    const uint16_t temperature = history_temperature_code(sample);
+    const uint8_t humidity = history_humidity(sample);
+
+    if (hour->count == 0 || temperature < hour->temperature_min)
+        hour->temperature_min = temperature;
+    if (hour->count == 0 || temperature > hour->temperature_max)
+        hour->temperature_max = temperature;
+    if (hour->count == 0 || humidity < hour->humidity_min)
+        hour->humidity_min = humidity;
+    if (hour->count == 0 || humidity > hour->humidity_max)
+        hour->humidity_max = humidity;
+
+    hour->temperature_sum += temperature;
+    hour->humidity_sum += humidity;
+    hour->count++;
+}
+
+/* Queues erasing `count` slots from `slot`, a range still being erased is extended up to them */
+static void history_erase(uint16_t slot, uint16_t count)
+{
+    if (history.erase_count != 0)
+    {
+        count += (slot + HISTORY_SLOTS - history.erase_slot) % HISTORY_SLOTS;
+        slot = history.erase_slot;
+    }
+
+    history.erase_slot = slot;
+    history.erase_count = count < HISTORY_SLOTS ? count : HISTORY_SLOTS;
+}
+
+/* Adds the sample of `slot` to the aggregates */
+static void history_insert(uint16_t slot, uint16_t sample)
+{
+    const uint8_t hour = slot / HISTORY_SLOTS_PER_HOUR;
+
+    if (hour != history.hour)
+    {
+        // every hour up to the new one is a day old, or was skipped
+        do
+        {
+            history.hour = (history.hour + 1) % HISTORY_HOURS;
+            memset(&history.hours[history.hour], 0, sizeof(history_hour_t));
+        } while (history.hour != hour);
+
+        history_extremes_update();
+    }
+
+    history_bucket_add(&history.hours[hour], sample);
+
+    // only the new sample can move the extremes
+    history_hour_t single = {};
+    history_bucket_add(&single, sample);
+    history_extremes_add(&single);
+}
+
+static void history_load_start()
+{
+    history.next = history_slot_of(rtc_now());
+    history.hour = history.next / HISTORY_SLOTS_PER_HOUR;
+    history.load_index = 0;
+    history.load_head = HISTORY_NONE;
+    history.pending |= HISTORY_FIND_HEAD;
+
+    scheduler_arm(history.task, 0);
+}
+
+/* Rebuilds the aggregates from the EEPROM ring in steps, `history.next` is the current slot */
+static void history_load_step()
+{
+    const uint16_t slot = history.next;
+
+    if (history.pending & HISTORY_FIND_HEAD)
+    {
+        for (uint8_t n = 0; n < HISTORY_LOAD_SLOTS && history.load_index < HISTORY_SLOTS; n++)
+        {
+            uint16_t word;
+            eeprom_read_block(&word, (const void *)(uintptr_t)history_address(history.load_index), sizeof(word));
+            if (word == HISTORY_HEAD)
+            {
+                history.load_head = history.load_index;
+                break;
+            }
+
+            history.load_index++;
+        }
+
+        if (history.load_index < HISTORY_SLOTS && history.load_head == HISTORY_NONE)
+            return;
+
+        // from the head up to the current slot, nothing if it is still the slot before the head
+        const uint16_t head = history.load_head;
+        if (head != HISTORY_NONE && slot != (head + HISTORY_SLOTS - 1) % HISTORY_SLOTS)
+            history_erase(head, (slot + HISTORY_SLOTS - head) % HISTORY_SLOTS);
+
+        history.load_index = 0;
+        history.pending = (history.pending & ~HISTORY_FIND_HEAD) | HISTORY_READ;
+        return;
+    }
+
+    for (uint8_t n = 0; n < HISTORY_LOAD_SLOTS && history.load_index < HISTORY_SLOTS; n++)
+    {
+        const uint16_t i = history.load_index++;
+
+        // the current slot is written again, the rest of its hour is from yesterday
+        if ((i + HISTORY_SLOTS - history.erase_slot) % HISTORY_SLOTS < history.erase_count)
+            continue;
+        if (i / HISTORY_SLOTS_PER_HOUR == history.hour && i >= slot)
+            continue;
+
+        uint16_t word;
+        eeprom_read_block(&word, (const void *)(uintptr_t)history_address(i), sizeof(word));
+        if (word < HISTORY_SAMPLE_END)
+            history_bucket_add(&history.hours[i / HISTORY_SLOTS_PER_HOUR], word);
+    }
+
+    if (history.load_index < HISTORY_SLOTS)
+        return;
+
+    history_extremes_update();
+
+    history.slot = slot;
+    history.pending &= ~HISTORY_READ;
+}
+
+/* Stores the average of the open slot */
+static void history_close()
+{
+    if (history.readings == 0)
+        return;
+
+    // rounded half away from zero
+    const long half = history.readings / 2;
+    const int16_t temperature =
+        (history.temperature_sum + (history.temperature_sum < 0 ? -half : half)) / history.readings;
+    const uint16_t humidity = (history.humidity_sum + history.readings / 2) / history.readings;
+    const uint16_t sample = history_pack(temperature, humidity);
+
+    history.readings = 0;
+    history.temperature_sum = 0;
+    history.humidity_sum = 0;
+
+    history_insert(history.slot, sample);
+
+    // the erase runs before the sample and the head are written
+    const uint16_t skipped = (history.slot + HISTORY_SLOTS - history.next) % HISTORY_SLOTS;
+    if (skipped != 0)
+        history_erase(history.next, skipped);
+    history.next = (history.slot + 1) % HISTORY_SLOTS;
+
+    history.sample = sample;
+    history.sample_slot = history.slot;
+    history.pending = HISTORY_WRITE_SAMPLE | HISTORY_WRITE_HEAD;
+    scheduler_arm(history.task, 0);
+}
+
+/* A sensor reading, 0.1 C and 0.1 % */
+static void history_add(int16_t temperature10, uint16_t humidity10)
+{
+    // slots follow the time of day, readings before it is known have none
+    if (!rtc_valid())
+        return;
+
+    if (history.slot == HISTORY_NONE)
+    {
+        if (!(history.pending & HISTORY_LOADING))
+            history_load_start();
+        return;
+    }
+
+    const uint16_t slot = history_slot_of(rtc_now());
+    if (slot != history.slot)
+        history_close();
+
+    history.slot = slot;
+
+    if (history.readings >= HISTORY_READINGS_MAX)
+        return;
+
+    history.temperature_sum += temperature10;
+    history.humidity_sum += humidity10;
+    history.readings++;
+}
+
+/*
+* Change over the last HISTORY_TREND_HOURS, 0.1 C and %. Returns the
+* HISTORY_TREND_* flags of the values set, none without samples to compare,
+* no temperature while either hour holds an out of range sample.
+*/
+static uint8_t history_trend(int16_t *temperature, int8_t *humidity)
+{
+    const history_hour_t *now = &history.hours[history.hour];
+    const history_hour_t *then = &history.hours[(history.hour + HISTORY_HOURS - HISTORY_TREND_HOURS) % HISTORY_HOURS];
+
+    if (now->count == 0 || then->count == 0)
+        return 0;
+
+    uint8_t trend = HISTORY_TREND_HUMIDITY;
+    *humidity = (int8_t)(now->humidity_sum / now->count) - (int8_t)(then->humidity_sum / then->count);
+
+    if (history_temperature_valid(now->temperature_min) && history_temperature_valid(now->temperature_max) &&
+        history_temperature_valid(then->temperature_min) && history_temperature_valid(then->temperature_max))
+    {
+        *temperature = (int16_t)(now->temperature_sum / now->count) - (int16_t)(then->temperature_sum / then->count);
+        trend |= HISTORY_TREND_TEMPERATURE;
+    }
+
+    return trend;
+}
+
+/* Loads the ring, then writes the erased slots, the sample and the head, one step or eeprom_writer block per run */
+static void history_flush()
+{
+    // eeprom_read_*() must not meet the writer's interrupt, both set EEAR
+    if ((history.pending & HISTORY_LOADING) ? !eeprom_writer_idle() : eeprom_writer_busy())
+    {
+        scheduler_arm(history.task, HISTORY_RETRY_MS);
+        return;
+    }
+
+    if (history.pending & HISTORY_LOADING)
+    {
+        history_load_step();
+        scheduler_arm(history.task, 0);
+        return;
+    }
+
+    if (history.erase_count != 0)
+    {
+        uint16_t count = HISTORY_SLOTS - history.erase_slot;
+        if (count > history.erase_count)
+            count = history.erase_count;
+        if (count > HISTORY_ERASE_SLOTS)
+            count = HISTORY_ERASE_SLOTS;
+
+        eeprom_writer_start(history_address(history.erase_slot), nullptr, count * 2, 0xFF);
+        history.erase_slot = (history.erase_slot + count) % HISTORY_SLOTS;
+        history.erase_count -= count;
+    }
+    else if (history.pending & HISTORY_WRITE_SAMPLE)
+    {
+        eeprom_writer_start(history_address(history.sample_slot), (const uint8_t *)&history.sample, 2);
+        history.pending &= ~HISTORY_WRITE_SAMPLE;
+    }
+    else if (history.pending & HISTORY_WRITE_HEAD)
+    {
+        const uint16_t head = (history.sample_slot + 1) % HISTORY_SLOTS;
+        eeprom_writer_start(history_address(head), (const uint8_t *)&history_head, 2);
+        history.pending &= ~HISTORY_WRITE_HEAD;
+    }
+    else
+    {
+        return;
+    }
+
+    scheduler_arm(history.task, HISTORY_RETRY_MS);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_HISTORY_H
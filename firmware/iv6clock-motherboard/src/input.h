@@ -0,0 +1,74 @@
+#ifndef IV6CLOCK_MOTHERBOARD_INPUT_H
+#define IV6CLOCK_MOTHERBOARD_INPUT_H
+
+#include <Arduino.h>
+
+#include "spsc_queue.h"
+
+/*
+* Input events from the ISRs to the main loop.
+*
+* The encoder (PCINT2) and the button (scan tick) push typed, timestamped
+* events into one spsc_queue_t, ActivityManager::handle_input() drains it
+* in batches. AVR ISRs do not nest, so the two ISRs are one producer.
+* Every event is kept until it is handled, a push into a full queue is
+* counted in input.overflows instead of silently merging with others.
+*
+* Events
+*   INPUT_ROTATE        one detent, `value` is the direction (+1 right)
+*                       and `weight` the acceleration of the detent
+*   INPUT_PRESS         the button went down (debounced)
+*   INPUT_RELEASE       the button went up
+*   INPUT_CLICK         press and release before a long press
+*   INPUT_DOUBLE_CLICK  a second click right after a click, instead of it
+*   INPUT_LONG_PRESS    the button is held
+*   INPUT_REPEAT        still held after the long press
+*/
+
+#define INPUT_QUEUE_SIZE 16
+
+enum
+{
+    INPUT_ROTATE,
+    INPUT_PRESS,
+    INPUT_RELEASE,
+    INPUT_CLICK,
+    INPUT_DOUBLE_CLICK,
+    INPUT_LONG_PRESS,
+    INPUT_REPEAT,
+};
+
+struct input_event_t
+{
+    uint8_t type;
+    int8_t value;
+    uint8_t weight;
+    // millis() at the event, low 16 bits
+    uint16_t time;
+};
+
+struct input_t
+{
+    spsc_queue_t<input_event_t, INPUT_QUEUE_SIZE> queue;
+
+    // events lost to a full queue, saturates, written by the ISRs only
+    volatile uint8_t overflows;
+};
+
+input_t input;
+
+static inline int8_t input_saturate(int16_t value)
+{
+    return value > INT8_MAX ? INT8_MAX : (value < INT8_MIN ? INT8_MIN : value);
+}
+
+/* ISR side */
+static void input_push(uint8_t type, int8_t value = 0, uint8_t weight = 1)
+{
+    const input_event_t event = {type, value, weight, (uint16_t)millis()};
+
+    if (!input.queue.push(event) && input.overflows != 0xFF)
+        input.overflows++;
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_INPUT_H
@@ -1,8 +1,8 @@
 #ifndef IV6CLOCK_MOTHERBOARD_IV6_N_H
 #define IV6CLOCK_MOTHERBOARD_IV6_N_H
 
+#include <avr/pgmspace.h>
 #include <stdint.h>
-#include <binary.h>
 
 /*
 * GRIDS
@@ -54,38 +54,177 @@
 *       D
 */
 
-uint8_t IV6_grids[5][2] = {
-        {B00000000, B00010000},
-        {B01000000, B00000000},
-        {B00100000, B00000000},
-        {B00010000, B00000000},
-        {B00001000, B00000000},
+/*
+* Board wiring
+*
+* The tables above are the rev1 PCB. A board revision is declared once as
+* an IV6_wiring<> of bit numbers in the 16 bit word (byte1 << 8 | byte2),
+* segments A..G and dp, then grids G1..G5. The font and grid tables below
+* are computed from it at compile time, the scan path only ever sees the
+* finished words. IV6_BOARD_REV selects the revision, -D IV6_BOARD_REV=N.
+*
+* The font: every glyph is listed by its segments and lives in flash.
+* Symbols 0..15 are the hex digits, so a digit value is its own symbol.
+* SYMBOL_DP can be or'ed into any symbol to light the decimal point.
+*/
+
+enum
+{
+    SEG_A = 1 << 0,
+    SEG_B = 1 << 1,
+    SEG_C = 1 << 2,
+    SEG_D = 1 << 3,
+    SEG_E = 1 << 4,
+    SEG_F = 1 << 5,
+    SEG_G = 1 << 6,
+};
+
+constexpr uint8_t IV6_bit_count(uint16_t bits)
+{
+    return bits == 0 ? 0 : (bits & 1) + IV6_bit_count(bits >> 1);
+}
+
+template <uint8_t A, uint8_t B, uint8_t C, uint8_t D, uint8_t E, uint8_t F, uint8_t G, uint8_t DP,
+          uint8_t G1, uint8_t G2, uint8_t G3, uint8_t G4, uint8_t G5>
+struct IV6_wiring
+{
+    static_assert(A < 16 && B < 16 && C < 16 && D < 16 && E < 16 && F < 16 && G < 16 && DP < 16,
+                  "segment bit out of the 16 bit word");
+    static_assert(G1 < 16 && G2 < 16 && G3 < 16 && G4 < 16 && G5 < 16, "grid bit out of the 16 bit word");
+    static_assert(IV6_bit_count(1u << A | 1u << B | 1u << C | 1u << D | 1u << E | 1u << F | 1u << G | 1u << DP |
+                                1u << G1 | 1u << G2 | 1u << G3 | 1u << G4 | 1u << G5) == 13,
+                  "two lines wired to the same bit");
+
+    static constexpr uint16_t dp = 1u << DP;
+
+    static constexpr uint16_t glyph(uint8_t segments)
+    {
+        return (segments & SEG_A ? 1u << A : 0) |
+               (segments & SEG_B ? 1u << B : 0) |
+               (segments & SEG_C ? 1u << C : 0) |
+               (segments & SEG_D ? 1u << D : 0) |
+               (segments & SEG_E ? 1u << E : 0) |
+               (segments & SEG_F ? 1u << F : 0) |
+               (segments & SEG_G ? 1u << G : 0);
+    }
+
+    static constexpr uint16_t grid(uint8_t grid)
+    {
+        return 1u << (grid == 0 ? G1 : grid == 1 ? G2 : grid == 2 ? G3 : grid == 3 ? G4 : G5);
+    }
+};
+
+#ifndef IV6_BOARD_REV
+#define IV6_BOARD_REV 1
+#endif
+
+#if IV6_BOARD_REV == 1
+//                 A  B  C  D   E   F  G  dp  G1  G2  G3  G4  G5
+typedef IV6_wiring<7, 1, 3, 15, 10, 5, 6, 2,  4,  14, 13, 12, 11> IV6_board;
+#else
+#error "Unknown IV6_BOARD_REV"
+#endif
+
+constexpr uint16_t IV6_glyph(uint8_t segments)
+{
+    return IV6_board::glyph(segments);
+}
+
+// G1 is the rightmost tube
+const uint16_t IV6_grids[5] PROGMEM = {
+        IV6_board::grid(0),
+        IV6_board::grid(1),
+        IV6_board::grid(2),
+        IV6_board::grid(3),
+        IV6_board::grid(4),
 };
 
-uint8_t IV6_numbers[16][2] = {
-        {B10000100, B10101010}, // 0 ABCDEF
-        {B00000000, B00001010}, // 1 BC
-        {B10000100, B11000010}, // 2 ABGED
-        {B10000000, B11001010}, // 3 ABCDG
-        {B00000000, B01101010}, // 4 BCFG
-        {B10000000, B11101000}, // 5 ACDFG
-        {B10000100, B11101000}, // 6 ACDEFG
-        {B00000000, B10001010}, // 7 ABC
-        {B10000100, B11101010}, // 8 ABCDEFG
-        {B10000000, B11101010}, // 9 ABCDFG
-        {B00000000, B00000000}, // EMPTY
-        {B00000000, B01000000}, // -
-        {B00000100, B11100010}, // P
-        {B00000000, B01101010}, // Ч
-        {B10000100, B10100000}, // C
-        {B00000000, B11100010}, // DEGREE
+enum
+{
+    SYMBOL_A = 10,
+    SYMBOL_B,
+    SYMBOL_C,
+    SYMBOL_D,
+    SYMBOL_E,
+    SYMBOL_F,
+    SYMBOL_EMPTY,
+    SYMBOL_MINUS,
+    SYMBOL_DEGREE,
+    SYMBOL_UNDERSCORE,
+    SYMBOL_C_SMALL,
+    SYMBOL_G,
+    SYMBOL_H,
+    SYMBOL_H_SMALL,
+    SYMBOL_I,
+    SYMBOL_J,
+    SYMBOL_L,
+    SYMBOL_N,
+    SYMBOL_O,
+    SYMBOL_P,
+    SYMBOL_Q,
+    SYMBOL_R,
+    SYMBOL_S,
+    SYMBOL_T,
+    SYMBOL_U,
+    SYMBOL_U_SMALL,
+    SYMBOL_Y,
+    SYMBOL_CH,
+    SYMBOL_COUNT,
 };
 
-#define SYMBOL_EMPTY  10
-#define SYMBOL_MINUS  11
-#define SYMBOL_P 12
-#define SYMBOL_CH 13
-#define SYMBOL_C 14
-#define SYMBOL_DEGREE 15
+#define SYMBOL_DP 0x80
+
+const uint16_t IV6_font[SYMBOL_COUNT] PROGMEM = {
+        IV6_glyph(SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F),         // 0
+        IV6_glyph(SEG_B | SEG_C),                                         // 1
+        IV6_glyph(SEG_A | SEG_B | SEG_D | SEG_E | SEG_G),                 // 2
+        IV6_glyph(SEG_A | SEG_B | SEG_C | SEG_D | SEG_G),                 // 3
+        IV6_glyph(SEG_B | SEG_C | SEG_F | SEG_G),                         // 4
+        IV6_glyph(SEG_A | SEG_C | SEG_D | SEG_F | SEG_G),                 // 5
+        IV6_glyph(SEG_A | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G),         // 6
+        IV6_glyph(SEG_A | SEG_B | SEG_C),                                 // 7
+        IV6_glyph(SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G), // 8
+        IV6_glyph(SEG_A | SEG_B | SEG_C | SEG_D | SEG_F | SEG_G),         // 9
+        IV6_glyph(SEG_A | SEG_B | SEG_C | SEG_E | SEG_F | SEG_G),         // A
+        IV6_glyph(SEG_C | SEG_D | SEG_E | SEG_F | SEG_G),                 // b
+        IV6_glyph(SEG_A | SEG_D | SEG_E | SEG_F),                         // C
+        IV6_glyph(SEG_B | SEG_C | SEG_D | SEG_E | SEG_G),                 // d
+        IV6_glyph(SEG_A | SEG_D | SEG_E | SEG_F | SEG_G),                 // E
+        IV6_glyph(SEG_A | SEG_E | SEG_F | SEG_G),                         // F
+        IV6_glyph(0),                                                     // EMPTY
+        IV6_glyph(SEG_G),                                                 // -
+        IV6_glyph(SEG_A | SEG_B | SEG_F | SEG_G),                         // DEGREE
+        IV6_glyph(SEG_D),                                                 // _
+        IV6_glyph(SEG_D | SEG_E | SEG_G),                                 // c
+        IV6_glyph(SEG_A | SEG_C | SEG_D | SEG_E | SEG_F),                 // G
+        IV6_glyph(SEG_B | SEG_C | SEG_E | SEG_F | SEG_G),                 // H
+        IV6_glyph(SEG_C | SEG_E | SEG_F | SEG_G),                         // h
+        IV6_glyph(SEG_E | SEG_F),                                         // I
+        IV6_glyph(SEG_B | SEG_C | SEG_D | SEG_E),                         // J
+        IV6_glyph(SEG_D | SEG_E | SEG_F),                                 // L
+        IV6_glyph(SEG_C | SEG_E | SEG_G),                                 // n
+        IV6_glyph(SEG_C | SEG_D | SEG_E | SEG_G),                         // o
+        IV6_glyph(SEG_A | SEG_B | SEG_E | SEG_F | SEG_G),                 // P
+        IV6_glyph(SEG_A | SEG_B | SEG_C | SEG_F | SEG_G),                 // q
+        IV6_glyph(SEG_E | SEG_G),                                         // r
+        IV6_glyph(SEG_A | SEG_C | SEG_D | SEG_F | SEG_G),                 // S
+        IV6_glyph(SEG_D | SEG_E | SEG_F | SEG_G),                         // t
+        IV6_glyph(SEG_B | SEG_C | SEG_D | SEG_E | SEG_F),                 // U
+        IV6_glyph(SEG_C | SEG_D | SEG_E),                                 // u
+        IV6_glyph(SEG_B | SEG_C | SEG_D | SEG_F | SEG_G),                 // y
+        IV6_glyph(SEG_B | SEG_C | SEG_F | SEG_G),                         // Ч
+};
+
+/* Register word of a symbol, SYMBOL_DP adds the decimal point */
+static inline uint16_t IV6_symbol_word(uint8_t symbol)
+{
+    const uint16_t word = pgm_read_word(&IV6_font[symbol & ~SYMBOL_DP]);
+    return symbol & SYMBOL_DP ? word | IV6_board::dp : word;
+}
+
+static inline uint16_t IV6_grid_word(uint8_t grid)
+{
+    return pgm_read_word(&IV6_grids[grid]);
+}
 
 #endif //IV6CLOCK_MOTHERBOARD_IV6_N_H
@@ -0,0 +1,125 @@
+#ifndef IV6CLOCK_MOTHERBOARD_LDR_H
+#define IV6CLOCK_MOTHERBOARD_LDR_H
+
+#include <Arduino.h>
+#include <util/atomic.h>
+
+/*
+* Ambient light from the LDR on ADC2 (PC2), brighter reads higher.
+*
+* The ADC is auto-triggered by the Timer0 overflow that also drives
+* millis(), so it converts about 976 times a second and nothing waits
+* for a conversion. ldr_sample() runs from ADC_vect and folds each
+* reading into an exponential moving average
+*
+*   filtered += reading - filtered / 2^LDR_EMA_SHIFT
+*
+* kept scaled by 2^LDR_EMA_SHIFT, so no fraction is lost and the time
+* constant is 2^LDR_EMA_SHIFT samples, about a second.
+*
+* Curve
+*
+* ldr_curve_eval() maps the light level (reading / 4) through
+* LDR_CURVE_POINTS points, linearly in between and flat past both ends,
+* to an LED and a VFD brightness, both 0..255. The points are ordered by
+* light level and kept in the settings.
+*/
+
+#define LDR_CHANNEL 2
+#define LDR_EMA_SHIFT 10
+#define LDR_CURVE_POINTS 4
+
+struct ldr_point_t
+{
+    // reading / 4
+    uint8_t light;
+    uint8_t led;
+    uint8_t vfd;
+};
+
+struct ldr_t
+{
+    // reading << LDR_EMA_SHIFT
+    volatile uint32_t filtered;
+    volatile uint8_t primed;
+};
+
+ldr_t ldr;
+
+static void ldr_init()
+{
+    // the pin is analog only, its digital input buffer just burns power
+    DIDR0 |= _BV(ADC0D + LDR_CHANNEL);
+
+    ADMUX = _BV(REFS0) | LDR_CHANNEL;
+    // trigger source Timer0 overflow
+    ADCSRB = _BV(ADTS2);
+    // 16 MHz / 128, 104 us a conversion
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+/* Called from ADC_vect */
+static inline void ldr_sample()
+{
+    const uint16_t reading = ADC;
+
+    // the first reading seeds the average instead of rising from 0
+    if (!ldr.primed)
+    {
+        ldr.filtered = (uint32_t)reading << LDR_EMA_SHIFT;
+        ldr.primed = 1;
+        return;
+    }
+
+    ldr.filtered += reading - (ldr.filtered >> LDR_EMA_SHIFT);
+}
+
+static inline bool ldr_ready()
+{
+    return ldr.primed;
+}
+
+/* Filtered light level, 0..255 */
+static uint8_t ldr_light()
+{
+    uint32_t filtered;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        filtered = ldr.filtered;
+    }
+
+    return filtered >> (LDR_EMA_SHIFT + 2);
+}
+
+static inline uint8_t ldr_lerp(uint8_t from, uint8_t to, uint8_t x, uint8_t span)
+{
+    return from + (int16_t)(((long)to - from) * x / span);
+}
+
+static void ldr_curve_eval(const ldr_point_t *curve, uint8_t light, uint8_t *led, uint8_t *vfd)
+{
+    const ldr_point_t *a = &curve[0];
+    const ldr_point_t *b = a;
+
+    for (uint8_t i = 1; i < LDR_CURVE_POINTS && light > b->light; i++)
+    {
+        a = b;
+        b = &curve[i];
+    }
+
+    // before the first point, past the last one, or right on a point
+    if (light <= a->light || light >= b->light)
+    {
+        const ldr_point_t *point = light <= a->light ? a : b;
+        *led = point->led;
+        *vfd = point->vfd;
+        return;
+    }
+
+    const uint8_t x = light - a->light;
+    const uint8_t span = b->light - a->light;
+    *led = ldr_lerp(a->led, b->led, x, span);
+    *vfd = ldr_lerp(a->vfd, b->vfd, x, span);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_LDR_H
@@ -1,8 +1,12 @@
-#include <Wire.h>
-#include <MsTimer2.h>
+#include <TwiQueue.h>
 #include <util/delay.h>
 
 #include "iv6_n.h"
+#include "display.h"
+#include "animation.h"
+#include "text.h"
+#include "scheduler.h"
+#include "power.h"
 
 #define FASTLED_ENABLED 1
 
@@ -12,50 +16,60 @@
 
 #ifdef FASTLED_ENABLED
 
-#include <FastLED.h>
+#include "backlight.h"
 
 #define PIN_WS21B_DATA analogInputToDigitalPin(1)
 
-#define NUM_LEDS 5
-#define LED_DITHER 255
+// frames are only pushed on change, temporal dithering needs a steady refresh
+#define LED_DITHER DISABLE_DITHER
 #define CORRECTION TypicalLEDStrip
 
 uint8_t BRIGHTNESS_HIGH = 255;
-uint8_t BRIGHTNESS_LOW = 100;
-CRGB leds[NUM_LEDS];
 
 CHSV solid_color;
 #endif
 
-void fastled_render_routine()
-{
-#ifdef FASTLED_ENABLED
-    for (int i = NUM_LEDS - 1; i >= 0; i--)
-    {
-        leds[i] = solid_color;
-    }
-    FastLED.show();
-#endif
-}
-
 /***********************************
 * Shift Register
 ***********************************/
 
-#define PIN_SR_DATA (uint8_t)5  //PD5  // DS
-#define PIN_SR_CLOCK (uint8_t)6 //PD6 // SH_CP
-#define PIN_SR_LATCH (uint8_t)7 //PD7 // ST_CP
+#include "shift_register.h"
+#include "scan_stats.h"
 
 /***********************************
-* RTC
+* Serial port
 ***********************************/
 
-#include <DS3231.h>
+// USART0 is the serial port unless it drives the shift registers
+#if SR_BACKEND != SR_BACKEND_USART
+#define PROTOCOL_ENABLED 1
+#endif
+
+#ifdef PROTOCOL_ENABLED
+
+#include "protocol.h"
+
+ISR(USART_RX_vect)
+{
+    uart_rx_ready();
+}
+
+ISR(USART_UDRE_vect)
+{
+    uart_tx_ready();
+}
+#endif
+
+/***********************************
+* RTC
+***********************************/
 
-DS3231 clock;
-DateTime now;
+#include "rtc.h"
 
-#define PIN_SQW 10 //PB2
+ISR(PCINT0_vect)
+{
+    rtc_sqw_edge();
+}
 
 /***********************************
 * DHT12
@@ -68,90 +82,103 @@ DateTime now;
 #include "DHT12.h"
 
 DHT12 dht12;
-unsigned long int temp_read_timer;
 #endif
 
 /***********************************
-* EEPROM
+* Settings
 ***********************************/
 
-#include <avr/eeprom.h>
+#include "settings.h"
 
-#define EEPROM_ADDR_COLOR 0
-#define EEPROM_ADDR_BRIGHTNESS 1
+#include "history.h"
 
-void EEPROM_save(uint8_t color, uint8_t brightness)
+ISR(EE_READY_vect)
 {
-    eeprom_write_byte((uint8_t *)EEPROM_ADDR_COLOR, color);
-    eeprom_write_byte((uint8_t *)EEPROM_ADDR_BRIGHTNESS, brightness);
+    eeprom_writer_ready();
 }
 
 /***********************************
 * IV6
 ***********************************/
 
-unsigned long int render_timer;
-
 volatile uint8_t scan_grid_n = 0;
 
-struct
-{
-    volatile uint8_t byte_0;
-    volatile uint8_t byte_1;
-    volatile uint8_t byte_2;
-    volatile uint8_t byte_3;
-    volatile uint8_t byte_4;
-} display_bytes;
-
 /***********************************
 * LDR
 ***********************************/
 
-#define PIN_LDR A2
-#define LDR_LOW_TRESHOLD 600
-#define LDR_HIGH_TRESHOLD 700
+#include "ldr.h"
 
-enum
+ISR(ADC_vect)
 {
-    LDR_STATE_HIGH,
-    LDR_STATE_LOW,
-};
+    ldr_sample();
+}
 
-unsigned long int ldr_timer;
-uint8_t ldr_state = LDR_STATE_HIGH;
-uint8_t ldr_toggle = 0;
+#define AMBIENT_FADE_MS 1000
+// LED steps smaller than this are ignored, noise does not restart the fade
+#define AMBIENT_LED_DEADBAND 2
+// the curve has to leave the band of the VFD level by this much
+#define AMBIENT_VFD_HYSTERESIS 4
+#define AMBIENT_VFD_STEP (256 / DISPLAY_LEVELS)
 
-void ldr_routine()
+uint8_t ambient_started = 0;
+
+/*
+* Follows the filtered light along the curve, `fade_ms` 0 applies it at once.
+* True if the LED or the VFD brightness changed.
+*/
+static bool ambient_apply(uint16_t fade_ms)
 {
-    int ldr_val = analogRead(PIN_LDR);
+    if (!ldr_ready())
+        return false;
 
-    if (ldr_toggle == 0)
+    uint8_t led, vfd;
+    ldr_curve_eval(settings.ldr_curve, ldr_light(), &led, &vfd);
+
+    bool changed = false;
+
+#ifdef FASTLED_ENABLED
+    const uint8_t value = scale8_video(BRIGHTNESS_HIGH, led);
+    if (fade_ms == 0 || abs(value - solid_color.value) > AMBIENT_LED_DEADBAND)
     {
-        if ((ldr_val < LDR_LOW_TRESHOLD && ldr_state == LDR_STATE_HIGH) ||
-            (ldr_val > LDR_HIGH_TRESHOLD && ldr_state == LDR_STATE_LOW))
-        {
-            ldr_toggle = 1;
-            ldr_timer = millis();
-        }
+        solid_color.value = value;
+        backlight_fade_to(value, fade_ms);
+        changed = true;
     }
-    else
+#endif
+
+    const uint16_t band = display.brightness * AMBIENT_VFD_STEP;
+    if (vfd / AMBIENT_VFD_STEP != display.brightness &&
+        (fade_ms == 0 || vfd >= band + AMBIENT_VFD_STEP + AMBIENT_VFD_HYSTERESIS ||
+         vfd + AMBIENT_VFD_HYSTERESIS < band))
     {
-        if (millis() - ldr_timer > 5000)
-        {
-            ldr_toggle = 0;
-
-            if (ldr_state == LDR_STATE_HIGH && ldr_val < LDR_LOW_TRESHOLD)
-            {
-                ldr_state = LDR_STATE_LOW;
-                solid_color.value = BRIGHTNESS_LOW;
-            }
-            else if (ldr_state == LDR_STATE_LOW && ldr_val > LDR_HIGH_TRESHOLD)
-            {
-                ldr_state = LDR_STATE_HIGH;
-                solid_color.value = BRIGHTNESS_HIGH;
-            }
-        }
+        display_set_brightness(vfd / AMBIENT_VFD_STEP);
+        display_commit();
+        changed = true;
     }
+
+    return changed;
+}
+
+/* Light level and the brightness it led to, for the serial log */
+static void ambient_log()
+{
+#ifdef PROTOCOL_ENABLED
+#ifdef FASTLED_ENABLED
+    const uint8_t led = solid_color.value;
+#else
+    const uint8_t led = 0;
+#endif
+    const uint8_t entry[] = {ldr_light(), led, display.brightness};
+    protocol_log(PROTOCOL_LOG_AMBIENT, entry, sizeof(entry));
+#endif
+}
+
+void ldr_routine()
+{
+    if (ambient_apply(ambient_started ? AMBIENT_FADE_MS : 0))
+        ambient_log();
+    ambient_started = ldr_ready();
 }
 
 /***********************************
@@ -160,120 +187,156 @@ void ldr_routine()
 
 #include "menu.h"
 
-ActivityManager activity_manager;
-
-ClockActivity clock_activity(&activity_manager);
-MainMenuActivity main_menu_activity(&activity_manager);
-TimeSetupActivity time_setup_activity(&activity_manager);
-ColorSetupActivity color_setup_activity(&activity_manager);
-
-typedef const menu_t menu;
-menu main_menu = {
-    .size = 3,
-    .items = {
-        {
-            .title = SYMBOL_C,
-            .activity = &color_setup_activity,
-        },
-        {
-            .title = SYMBOL_CH,
-            .activity = &time_setup_activity,
-        },
-        {
-            .title = SYMBOL_MINUS,
-            .activity = &clock_activity,
-        },
-    },
+ClockActivity clock_activity;
+MainMenuActivity main_menu_activity;
+TimeSetupActivity time_setup_activity;
+ColorSetupActivity color_setup_activity;
+HistoryActivity history_activity;
+
+const menu_item_t main_menu_items[] PROGMEM = {
+    {/*title=*/SYMBOL_C, /*activity=*/ACTIVITY_COLOR_SETUP},
+    {/*title=*/SYMBOL_CH, /*activity=*/ACTIVITY_TIME_SETUP},
+    {/*title=*/SYMBOL_H, /*activity=*/ACTIVITY_HISTORY},
+    {/*title=*/SYMBOL_MINUS, /*activity=*/ACTIVITY_CLOCK},
 };
 
+const menu_t main_menu PROGMEM = menu_of(main_menu_items);
+
+// returns `call` on the registered instance of `id`, also for void calls
+#define ACTIVITY_DISPATCH(id, call)            \
+    switch (id)                                \
+    {                                          \
+    case ACTIVITY_CLOCK:                       \
+        return clock_activity.call;            \
+    case ACTIVITY_MAIN_MENU:                   \
+        return main_menu_activity.call;        \
+    case ACTIVITY_TIME_SETUP:                  \
+        return time_setup_activity.call;       \
+    case ACTIVITY_COLOR_SETUP:                 \
+        return color_setup_activity.call;      \
+    case ACTIVITY_HISTORY:                     \
+        return history_activity.call;          \
+    }
+
+static void activity_init(uint8_t id)
+{
+    ACTIVITY_DISPATCH(id, init());
+}
+
+static void activity_resume(uint8_t id)
+{
+    ACTIVITY_DISPATCH(id, resume());
+}
+
+static void activity_render(uint8_t id)
+{
+    ACTIVITY_DISPATCH(id, render());
+}
+
+static void activity_tick(uint8_t id)
+{
+    ACTIVITY_DISPATCH(id, tick());
+}
+
+static void activity_animation_done(uint8_t id)
+{
+    ACTIVITY_DISPATCH(id, animation_done());
+}
+
+static void activity_rotate(uint8_t id, int8_t delta)
+{
+    ACTIVITY_DISPATCH(id, rotate(delta));
+}
+
+static void activity_event(uint8_t id, uint8_t type)
+{
+    ACTIVITY_DISPATCH(id, event(type));
+}
+
+static bool activity_rotate_accelerated(uint8_t id)
+{
+    ACTIVITY_DISPATCH(id, rotate_accelerated());
+    return false;
+}
+
+static uint8_t activity_watches(uint8_t id)
+{
+    ACTIVITY_DISPATCH(id, watches());
+    return 0;
+}
+
 /***********************************
 * MainMenu Activity
 ***********************************/
 
 void MainMenuActivity::render()
 {
-    display_bytes.byte_0 = SYMBOL_P;
-    display_bytes.byte_1 = SYMBOL_EMPTY;
-    display_bytes.byte_2 = SYMBOL_EMPTY;
-    display_bytes.byte_3 = SYMBOL_EMPTY;
-    display_bytes.byte_4 = this->menu->items[this->_index].title;
+    display_set(0, SYMBOL_P);
+    display_set(1, SYMBOL_EMPTY);
+    display_set(2, SYMBOL_EMPTY);
+    display_set(3, SYMBOL_EMPTY);
+    display_set(4, this->title());
 }
 
 /***********************************
 * Clock Activity
 ***********************************/
 
-void ClockActivity::render()
+void ClockActivity::temperature_symbols(uint8_t *symbols)
 {
-    if (this->mode == 0)
-    {
-        display_bytes.byte_0 = now.hour() / 10;
-        display_bytes.byte_1 = now.hour() % 10;
-        if (digitalRead(PIN_SQW) == HIGH)
-            display_bytes.byte_2 = SYMBOL_MINUS;
-        else
-            display_bytes.byte_2 = SYMBOL_EMPTY;
-        display_bytes.byte_3 = now.minute() / 10;
-        display_bytes.byte_4 = now.minute() % 10;
-    }
-    else
-    {
 #ifdef DHT12_ENABLED
-        uint8_t temperature = dht12.getTemperature() - 4;
-        display_bytes.byte_0 = SYMBOL_EMPTY;
-        display_bytes.byte_1 = SYMBOL_EMPTY;
-        display_bytes.byte_2 = temperature / 10;
-        display_bytes.byte_3 = temperature % 10;
-        display_bytes.byte_4 = SYMBOL_DEGREE;
+    int16_t temperature = dht12.getTemperature10() + settings.temp_offset;
+
+    // round to whole degrees
+    temperature = (temperature + (temperature < 0 ? -5 : 5)) / 10;
+
+    text_printf(symbols, DISPLAY_DIGITS, PSTR(" %3d*"), temperature);
 #endif
-    }
+}
+
+void ClockActivity::resume()
+{
+    this->time_shown = millis();
+}
+
+void ClockActivity::time_symbols(uint8_t *symbols, bool separator)
+{
+    const rtc_time_t now = rtc_now();
 
+    text_printf(symbols, DISPLAY_DIGITS, PSTR("%02d%c%02d"), now.hour, separator ? '-' : ' ', now.minute);
+}
+
+void ClockActivity::render()
+{
+    this->time_symbols(display.symbols, rtc.sqw_level);
+}
+
+/* Shows the temperature for a while every 20 seconds, runs on the clock ticks while the clock is on */
+void ClockActivity::tick()
+{
 #ifdef DHT12_ENABLED
-    if (mode == 0 && millis() - mode_render_timer > 20000)
-    {
-        uint8_t running_bytes[5] = {
-            display_bytes.byte_0,
-            display_bytes.byte_1,
-            SYMBOL_MINUS,
-            display_bytes.byte_3,
-            display_bytes.byte_4
-        };
-
-        for (uint8_t i = 0; i < 5; i++)
-        {
-            for (uint8_t j = 0; j < 4 - i; j++)
-            {
-                running_bytes[j] = running_bytes[j + 1];
-            }
-
-            running_bytes[4 - i] = SYMBOL_EMPTY;
-
-            display_bytes.byte_0 = running_bytes[0];
-            display_bytes.byte_1 = running_bytes[1];
-            display_bytes.byte_2 = running_bytes[2];
-            display_bytes.byte_3 = running_bytes[3];
-            display_bytes.byte_4 = running_bytes[4];
-
-            _delay_ms(150);
-        }
-
-        mode = 1;
-        mode_render_timer = millis();
-    }
-    else if (mode == 1 && millis() - mode_render_timer > 3000)
-    {
-        mode = 0;
-        mode_render_timer = millis();
-    }
+    // nothing to show before the sensor was read once
+    if (!dht12.hasData() || animation_busy() || millis() - this->time_shown < 20000)
+        return;
+
+    uint8_t time_view[DISPLAY_DIGITS];
+    uint8_t temperature_view[DISPLAY_DIGITS];
+    this->time_symbols(time_view, true);
+    this->temperature_symbols(temperature_view);
+
+    // scroll the time out with its separator on, then keep the temperature
+    // for 3 seconds, animation_done() renders the time and restarts the count
+    animation_queue(time_view, ANIMATION_NONE, 0, 0);
+    animation_queue(temperature_view, ANIMATION_SCROLL_LEFT, 150, 3000);
 #endif
 }
 
-void ClockActivity::rotate(uint8_t direction) {}
+void ClockActivity::rotate(int8_t) {}
 
 void ClockActivity::press()
 {
     main_menu_activity.set_index(0);
-    this->_activity_manager->set_current(&main_menu_activity);
+    activity_manager.push(ACTIVITY_MAIN_MENU, ANIMATION_SCROLL_LEFT);
 }
 
 /***********************************
@@ -282,20 +345,14 @@ void ClockActivity::press()
 
 void TimeSetupActivity::render()
 {
-    display_bytes.byte_0 = SYMBOL_CH;
-    display_bytes.byte_1 = SYMBOL_EMPTY;
-    display_bytes.byte_2 = SYMBOL_EMPTY;
+    display_set(0, SYMBOL_CH);
+    display_set(1, SYMBOL_EMPTY);
+    display_set(2, SYMBOL_EMPTY);
 
     if (this->mode == TIME_SETUP_MODE_HOUR)
-    {
-        display_bytes.byte_3 = this->hour / 10;
-        display_bytes.byte_4 = this->hour % 10;
-    }
+        text_print(display.symbols, 3, 2, this->hour, TEXT_ZERO_PAD);
     else if (this->mode == TIME_SETUP_MODE_MINUTE)
-    {
-        display_bytes.byte_3 = this->minute / 10;
-        display_bytes.byte_4 = this->minute % 10;
-    }
+        text_print(display.symbols, 3, 2, this->minute, TEXT_ZERO_PAD);
 }
 
 /***********************************
@@ -335,18 +392,18 @@ void ColorSetupActivity::init()
 
 void ColorSetupActivity::render()
 {
-    display_bytes.byte_0 = SYMBOL_C;
-    display_bytes.byte_1 = SYMBOL_EMPTY;
-    display_bytes.byte_2 = SYMBOL_EMPTY;
-    display_bytes.byte_3 = SYMBOL_EMPTY;
+    display_set(0, SYMBOL_C);
+    display_set(1, SYMBOL_EMPTY);
+    display_set(2, SYMBOL_EMPTY);
+    display_set(3, SYMBOL_EMPTY);
 
     if (this->mode == COLOR_SETUP_MODE_COLOR)
     {
-        display_bytes.byte_4 = this->color;
+        display_set(4, this->color);
     }
     else if (this->mode == TIME_SETUP_MODE_MINUTE)
     {
-        display_bytes.byte_4 = this->brighness;
+        display_set(4, this->brighness);
     }
 }
 
@@ -379,162 +436,542 @@ void ColorSetupActivity::write_color() const
 
     BRIGHTNESS_HIGH = map(this->brighness, 0, 9, 0, 255);
 
-    solid_color.value = BRIGHTNESS_HIGH;
+    backlight_set_color(solid_color.hue, solid_color.saturation);
+    ambient_apply(0);
 
-    EEPROM_save(solid_color.hue, BRIGHTNESS_HIGH);
+    settings.hue = solid_color.hue;
+    settings.brightness = BRIGHTNESS_HIGH;
+    settings_save();
 }
 
 /***********************************
-* Encoder
+* History Activity
 ***********************************/
 
-struct encoder_t
-{
-    volatile uint8_t flag_R;
-    volatile uint8_t flag_L;
-    volatile uint8_t flag_BTN;
-    volatile uint8_t state;
+// too long for the tubes, they go through the marquee
+const char history_view_names[HISTORY_VIEWS][12] PROGMEM = {
+    "tEMP LO", "tEMP HI", "tEMP tREND", "HuMId LO", "HuMId HI", "HuMId tREND",
 };
 
-encoder_t encoder = {/*flag_R=*/0, /*flag_L=*/0, /*flag_BTN=*/0, /*state=*/0};
+void HistoryActivity::pick(uint8_t view)
+{
+    this->show(view);
 
-#define PIN_ENCODER_A PD2
-#define PIN_ENCODER_B PD3
-#define PIN_ENCODER_BTN PD4
+    animation_clear();
+    text_marquee_printf(TEXT_MARQUEE_STEP_MS, 1, history_view_names[view]);
+}
 
-/* Rotation handler */
-void encoderRotH()
+void HistoryActivity::tick()
 {
-    const uint8_t pin_a_high = digitalRead(PIN_ENCODER_A);
-    const uint8_t pin_b_high = digitalRead(PIN_ENCODER_B);
-
-    if (!pin_a_high && pin_b_high)
-        encoder.state = 1;
-    if (!pin_a_high && !pin_b_high)
-        encoder.state = 2;
+    // the value stays for HISTORY_VIEW_MS once its name went by
+    if (text_marquee_busy())
+        this->view_timer = millis();
+    else if (millis() - this->view_timer >= HISTORY_VIEW_MS)
+        this->show((this->view + 1) % HISTORY_VIEWS);
+}
 
-    if (pin_a_high && encoder.state != 0)
+void HistoryActivity::render()
+{
+    int16_t temperature_trend = 0;
+    int8_t humidity_trend = 0;
+    const bool samples = history.samples != 0;
+    const uint8_t trend = history_trend(&temperature_trend, &humidity_trend);
+    const bool minimum = samples && history_temperature_valid(history.temperature_min);
+    const bool maximum = samples && history_temperature_valid(history.temperature_max);
+
+    // a label, then the value in 0.1 C or %, dashes without samples or out of range
+    switch (this->view)
     {
-        if ((encoder.state == 1 && !pin_b_high) || (encoder.state == 2 && pin_b_high))
-        {
-            if (encoder.state == 1)
-                encoder.flag_L = 1;
-            if (encoder.state == 2)
-                encoder.flag_R = 1;
-            encoder.state = 0;
-        }
+    case HISTORY_VIEW_TEMPERATURE_MIN:
+        text_printf(display.symbols, DISPLAY_DIGITS, minimum ? PSTR("L%4.1d") : PSTR("L ---"),
+                    history_temperature(history.temperature_min));
+        break;
+    case HISTORY_VIEW_TEMPERATURE_MAX:
+        text_printf(display.symbols, DISPLAY_DIGITS, maximum ? PSTR("H%4.1d") : PSTR("H ---"),
+                    history_temperature(history.temperature_max));
+        break;
+    case HISTORY_VIEW_TEMPERATURE_TREND:
+        text_printf(display.symbols, DISPLAY_DIGITS, trend & HISTORY_TREND_TEMPERATURE ? PSTR("t%4.1d") : PSTR("t ---"),
+                    temperature_trend);
+        break;
+    case HISTORY_VIEW_HUMIDITY_MIN:
+        text_printf(display.symbols, DISPLAY_DIGITS, samples ? PSTR("hL%3d") : PSTR("hL---"), history.humidity_min);
+        break;
+    case HISTORY_VIEW_HUMIDITY_MAX:
+        text_printf(display.symbols, DISPLAY_DIGITS, samples ? PSTR("hH%3d") : PSTR("hH---"), history.humidity_max);
+        break;
+    case HISTORY_VIEW_HUMIDITY_TREND:
+        text_printf(display.symbols, DISPLAY_DIGITS, trend & HISTORY_TREND_HUMIDITY ? PSTR("ht%3d") : PSTR("ht---"),
+                    humidity_trend);
+        break;
     }
 }
 
+/***********************************
+* Input
+***********************************/
+
+#include "encoder.h"
+#include "button.h"
+
 ISR(PCINT2_vect)
 {
-    if (digitalRead(PIN_ENCODER_BTN) == 1)
-    {
-        encoder.flag_BTN = 1;
-    }
-    else
-    {
-        encoder.flag_BTN = 0;
-    }
+    encoder_pin_change();
 }
 
-static void encoder_init()
+static void input_routine()
 {
-    pinMode(PIN_ENCODER_A, INPUT);
-    pinMode(PIN_ENCODER_B, INPUT);
-    pinMode(PIN_ENCODER_BTN, INPUT);
+    activity_manager.handle_input();
+}
+
+/***********************************
+* Render
+***********************************/
+
+void IV6_scan()
+{
+    const display_frame_t *frame = display_scan_frame(scan_grid_n);
+
+    OCR2B = frame->ticks[scan_grid_n];
+    sr_write((uint8_t)(frame->words[scan_grid_n] >> 8), (uint8_t)frame->words[scan_grid_n]);
+    display_scan_started(frame->ticks[scan_grid_n]);
 
-    attachInterrupt(digitalPinToInterrupt(PIN_ENCODER_A), encoderRotH, CHANGE);
+    scan_grid_n++;
+    if (scan_grid_n > 4)
+        scan_grid_n = 0;
+}
+
+void IV6_blank()
+{
+    sr_write((uint8_t)(DISPLAY_BLANK_WORD >> 8), (uint8_t)DISPLAY_BLANK_WORD);
+    display_scan_blanked();
+}
+
+/*
+* Timer2 compare A starts a grid slot, compare B ends it early for dimming.
+* The slot is also the button sampling tick.
+*/
+ISR(TIMER2_COMPA_vect)
+{
+    scan_stats_enter();
+    IV6_scan();
+    scan_stats_leave();
 
+    button_sample();
+}
+
+ISR(TIMER2_COMPB_vect)
+{
+    IV6_blank();
+}
+
+static void scan_timer_start()
+{
     cli();
-    PCICR |= 1u << PCIE2;
-    PCMSK2 |= 1u << PCINT20;
+    TCCR2A = _BV(WGM21);            // CTC, TOP = OCR2A
+    TCCR2B = _BV(CS22) | _BV(CS21); // F_CPU / 256
+    OCR2A = DISPLAY_SCAN_TICKS - 1;
+    OCR2B = DISPLAY_TICKS_FULL;
+    TCNT2 = 0;
+    TIFR2 = _BV(OCF2A) | _BV(OCF2B);
+    TIMSK2 = _BV(OCIE2A) | _BV(OCIE2B);
     sei();
 }
 
-static void encoder_routine()
+/* Runs once per invalidate(), an animation or marquee invalidates when done */
+static void display_render_routine()
+{
+    if (animation_busy() || text_marquee_busy())
+        return;
+
+    activity_manager.render();
+    display_commit();
+}
+
+static void animation_routine()
+{
+    if (!animation_busy())
+        return;
+
+    animation_tick();
+    if (!animation_busy())
+        activity_manager.animation_done();
+}
+
+static void marquee_routine()
+{
+    text_marquee_step();
+    if (!text_marquee_busy())
+        activity_manager.invalidate();
+}
+
+static void rtc_task_routine()
+{
+    rtc_routine();
+    if (!rtc_changed())
+        return;
+
+    activity_manager.tick();
+    activity_manager.notify(WATCH_TIME);
+}
+
+/***********************************
+* Serial protocol
+***********************************/
+
+#ifdef PROTOCOL_ENABLED
+
+#define PROTOCOL_SCAN_RESET 0x01
+// keeps the ring for PROTOCOL_SCAN_SAMPLES, reading its last page lets it go
+#define PROTOCOL_SCAN_FREEZE 0x02
+#define PROTOCOL_SCAN_SAMPLES_MAX 8
+
+static_assert(1 + PROTOCOL_SCAN_SAMPLES_MAX * 4 <= PROTOCOL_PAYLOAD_MAX, "scan samples do not fit a frame");
+
+/* Takes over settings written by the host */
+static void settings_apply()
+{
+#ifdef FASTLED_ENABLED
+    solid_color.hue = settings.hue;
+    BRIGHTNESS_HIGH = settings.brightness;
+    backlight_set_color(solid_color.hue, solid_color.saturation);
+    backlight_set_effect(settings.effect, settings.effect_span);
+#endif
+    ambient_apply(0);
+}
+
+#ifdef DHT12_ENABLED
+/* Status, temperature with the offset in 0.1 C, humidity in 0.1 %, like PROTOCOL_SENSORS */
+static void protocol_log_sensors(int8_t status)
+{
+    const int16_t temperature = dht12.getTemperature10() + settings.temp_offset;
+    const int16_t humidity = dht12.getHumidity10();
+
+    uint8_t entry[5];
+    entry[0] = status;
+    memcpy(entry + 1, &temperature, sizeof(temperature));
+    memcpy(entry + 3, &humidity, sizeof(humidity));
+    protocol_log(PROTOCOL_LOG_SENSORS, entry, sizeof(entry));
+}
+#endif
+
+static uint8_t protocol_get_time()
+{
+    const rtc_time_t now = rtc_now();
+    protocol_put<uint8_t>(now.hour);
+    protocol_put<uint8_t>(now.minute);
+    protocol_put<uint8_t>(now.second);
+
+    return PROTOCOL_OK;
+}
+
+static uint8_t protocol_set_time(const uint8_t *payload, uint8_t length)
+{
+    if (length != 3)
+        return PROTOCOL_ERROR_LENGTH;
+    if (payload[0] > 23 || payload[1] > 59 || payload[2] > 59)
+        return PROTOCOL_ERROR_ARGUMENT;
+    if (!rtc_set_time(payload[0], payload[1], payload[2]))
+        return PROTOCOL_ERROR_BUSY;
+
+    activity_manager.notify(WATCH_TIME);
+
+    return PROTOCOL_OK;
+}
+
+static uint8_t protocol_sensors()
+{
+#ifdef DHT12_ENABLED
+    protocol_put<int8_t>(dht12.getStatus());
+    protocol_put<int16_t>(dht12.getTemperature10() + settings.temp_offset);
+    protocol_put<int16_t>(dht12.getHumidity10());
+#else
+    protocol_put<int8_t>(-1);
+    protocol_put<int16_t>(0);
+    protocol_put<int16_t>(0);
+#endif
+
+    protocol_put<uint8_t>(ldr_ready());
+    protocol_put<uint8_t>(ldr_light());
+#ifdef FASTLED_ENABLED
+    protocol_put<uint8_t>(solid_color.value);
+#else
+    protocol_put<uint8_t>(0);
+#endif
+    protocol_put<uint8_t>(display.brightness);
+
+    return PROTOCOL_OK;
+}
+
+/* The record payload: version, size, then settings_t as stored in EEPROM */
+static uint8_t protocol_get_settings()
 {
-    if (encoder.flag_R)
+    protocol_put<uint8_t>(SETTINGS_VERSION);
+    protocol_put<uint8_t>(sizeof(settings));
+    protocol_put_bytes(&settings, sizeof(settings));
+
+    return PROTOCOL_OK;
+}
+
+/* Same layout as protocol_get_settings(), a shorter settings_t keeps the fields it lacks */
+static uint8_t protocol_set_settings(const uint8_t *payload, uint8_t length)
+{
+    if (length < 2 || length != 2 + payload[1])
+        return PROTOCOL_ERROR_LENGTH;
+    if (payload[0] != SETTINGS_VERSION)
+        return PROTOCOL_ERROR_ARGUMENT;
+
+    settings_t changed = settings;
+    memcpy(&changed, payload + 2, payload[1] < sizeof(changed) ? payload[1] : sizeof(changed));
+
+    for (uint8_t i = 1; i < LDR_CURVE_POINTS; i++)
     {
-        activity_manager.current_activity->rotate(ENCODER_ROTATION_RIGHT);
-        encoder.flag_R = 0;
+        if (changed.ldr_curve[i].light < changed.ldr_curve[i - 1].light)
+            return PROTOCOL_ERROR_ARGUMENT;
     }
 
-    if (encoder.flag_L)
+#ifdef FASTLED_ENABLED
+    if (changed.effect >= BACKLIGHT_EFFECTS)
+        return PROTOCOL_ERROR_ARGUMENT;
+#endif
+
+    settings = changed;
+    settings_apply();
+    settings_save();
+
+    return PROTOCOL_OK;
+}
+
+static uint8_t protocol_task_stats(const uint8_t *payload, uint8_t length)
+{
+    if (length != 1)
+        return PROTOCOL_ERROR_LENGTH;
+    if (payload[0] >= scheduler.count)
+        return PROTOCOL_ERROR_ARGUMENT;
+
+    const task_t *task = scheduler.tasks[payload[0]];
+
+    protocol_put<uint8_t>(scheduler.count);
+    protocol_put<uint8_t>(task->priority);
+    protocol_put<uint8_t>(task->flags);
+    protocol_put<uint16_t>(task->period_ms);
+    protocol_put<uint32_t>(task->stats.runs);
+    protocol_put<uint32_t>(task->stats.total_us);
+    protocol_put<uint16_t>(task->stats.max_us);
+    protocol_put<uint16_t>(task->stats.overruns);
+
+    return PROTOCOL_OK;
+}
+
+static uint8_t protocol_counters()
+{
+    protocol_put<uint32_t>(millis());
+    protocol_put<uint16_t>(power_duty_permille());
+    protocol_put<uint8_t>(input.overflows);
+    protocol_put<uint8_t>(uart.rx_overflows);
+    protocol_put<uint8_t>(uart.rx_errors);
+    protocol_put<uint16_t>(protocol.crc_errors);
+    protocol_put<uint16_t>(protocol.timeouts);
+    protocol_put<uint16_t>(protocol.log_drops);
+
+    return PROTOCOL_OK;
+}
+
+static uint8_t protocol_scan(const uint8_t *payload, uint8_t length)
+{
+#ifdef SCAN_STATS
+    if (length > 1)
+        return PROTOCOL_ERROR_LENGTH;
+
+    const uint8_t flags = length == 1 ? payload[0] : 0;
+
+    scan_totals_t totals;
+    scan_stats_take_totals(&totals);
+    scan_stats_freeze(flags & PROTOCOL_SCAN_FREEZE);
+    if (flags & PROTOCOL_SCAN_RESET)
+        scan_stats_reset();
+
+    protocol_put<uint32_t>(totals.count);
+    protocol_put<int32_t>(totals.period_deviation);
+    protocol_put<uint16_t>(totals.period_min);
+    protocol_put<uint16_t>(totals.period_max);
+    protocol_put<uint32_t>(totals.duration_sum);
+    protocol_put<uint16_t>(totals.duration_max);
+
+    return PROTOCOL_OK;
+#else
+    return PROTOCOL_ERROR_UNSUPPORTED;
+#endif
+}
+
+/* Samples of the ring frozen by PROTOCOL_SCAN from an offset on, oldest first */
+static uint8_t protocol_scan_samples(const uint8_t *payload, uint8_t length)
+{
+#ifdef SCAN_STATS
+    if (length != 1)
+        return PROTOCOL_ERROR_LENGTH;
+
+    const uint8_t offset = payload[0];
+    if (offset >= SCAN_STATS_RING)
+        return PROTOCOL_ERROR_ARGUMENT;
+
+    protocol_put<uint8_t>(offset);
+    uint8_t i = offset;
+    for (; i < SCAN_STATS_RING && i < offset + PROTOCOL_SCAN_SAMPLES_MAX; i++)
     {
-        activity_manager.current_activity->rotate(ENCODER_ROTATION_LEFT);
-        encoder.flag_L = 0;
+        const scan_sample_t sample = scan_stats_sample(i);
+        protocol_put<uint16_t>(sample.period);
+        protocol_put<uint16_t>(sample.duration);
     }
 
-    if (encoder.flag_BTN)
+    if (i == SCAN_STATS_RING)
+        scan_stats_freeze(false);
+
+    return PROTOCOL_OK;
+#else
+    return PROTOCOL_ERROR_UNSUPPORTED;
+#endif
+}
+
+static uint8_t protocol_history()
+{
+    int16_t temperature_trend = 0;
+    int8_t humidity_trend = 0;
+    const uint8_t trend = history_trend(&temperature_trend, &humidity_trend);
+
+    // out of range extremes go as the end codes, -10.0 and 41.0 C
+    protocol_put<uint16_t>(history.samples);
+    protocol_put<int16_t>(history_temperature(history.temperature_min));
+    protocol_put<int16_t>(history_temperature(history.temperature_max));
+    protocol_put<uint8_t>(history.humidity_min);
+    protocol_put<uint8_t>(history.humidity_max);
+    protocol_put<uint8_t>(trend);
+    protocol_put<int16_t>(temperature_trend);
+    protocol_put<int8_t>(humidity_trend);
+
+    return PROTOCOL_OK;
+}
+
+static uint8_t protocol_command(uint8_t command, const uint8_t *payload, uint8_t length)
+{
+    switch (command)
     {
-        _delay_ms(5);
-        if (digitalRead(PIN_ENCODER_BTN) == 1)
-        {
-            activity_manager.current_activity->press();
-        }
-        encoder.flag_BTN = 0;
+    case PROTOCOL_GET_TIME:
+        return length == 0 ? protocol_get_time() : PROTOCOL_ERROR_LENGTH;
+    case PROTOCOL_SET_TIME:
+        return protocol_set_time(payload, length);
+    case PROTOCOL_SENSORS:
+        return length == 0 ? protocol_sensors() : PROTOCOL_ERROR_LENGTH;
+    case PROTOCOL_GET_SETTINGS:
+        return length == 0 ? protocol_get_settings() : PROTOCOL_ERROR_LENGTH;
+    case PROTOCOL_SET_SETTINGS:
+        return protocol_set_settings(payload, length);
+    case PROTOCOL_TASK:
+        return protocol_task_stats(payload, length);
+    case PROTOCOL_COUNTERS:
+        return length == 0 ? protocol_counters() : PROTOCOL_ERROR_LENGTH;
+    case PROTOCOL_SCAN:
+        return protocol_scan(payload, length);
+    case PROTOCOL_SCAN_SAMPLES:
+        return protocol_scan_samples(payload, length);
+    case PROTOCOL_HISTORY:
+        return length == 0 ? protocol_history() : PROTOCOL_ERROR_LENGTH;
     }
+
+    return PROTOCOL_ERROR_COMMAND;
 }
+#endif
 
 /***********************************
-* Render
+* Tasks
 ***********************************/
 
-void IV6_scan()
+#ifdef DHT12_ENABLED
+static void dht12_on_read(int8_t status)
 {
-    uint8_t byte1;
-    uint8_t byte2;
+#ifdef PROTOCOL_ENABLED
+    protocol_log_sensors(status);
+#endif
 
-    switch (scan_grid_n)
-    {
-    case 0:
-        byte1 = IV6_numbers[display_bytes.byte_4][0] | IV6_grids[scan_grid_n][0];
-        byte2 = IV6_numbers[display_bytes.byte_4][1] | IV6_grids[scan_grid_n][1];
-        break;
-    case 1:
-        byte1 = IV6_numbers[display_bytes.byte_3][0] | IV6_grids[scan_grid_n][0];
-        byte2 = IV6_numbers[display_bytes.byte_3][1] | IV6_grids[scan_grid_n][1];
-        break;
-    case 2:
-        byte1 = IV6_numbers[display_bytes.byte_2][0] | IV6_grids[scan_grid_n][0];
-        byte2 = IV6_numbers[display_bytes.byte_2][1] | IV6_grids[scan_grid_n][1];
-        break;
-    case 3:
-        byte1 = IV6_numbers[display_bytes.byte_1][0] | IV6_grids[scan_grid_n][0];
-        byte2 = IV6_numbers[display_bytes.byte_1][1] | IV6_grids[scan_grid_n][1];
-        break;
-    case 4:
-        byte1 = IV6_numbers[display_bytes.byte_0][0] | IV6_grids[scan_grid_n][0];
-        byte2 = IV6_numbers[display_bytes.byte_0][1] | IV6_grids[scan_grid_n][1];
-        break;
-    default:
-        byte1 = SYMBOL_EMPTY;
-        byte2 = SYMBOL_EMPTY;
-    }
+    if (status != DHT12_OK)
+        return;
 
-    digitalWrite(PIN_SR_LATCH, LOW);
-    shiftOut(PIN_SR_DATA, PIN_SR_CLOCK, MSBFIRST, (uint8_t)~byte1);
-    shiftOut(PIN_SR_DATA, PIN_SR_CLOCK, MSBFIRST, (uint8_t)~byte2);
-    digitalWrite(PIN_SR_LATCH, HIGH);
+    history_add(dht12.getTemperature10() + settings.temp_offset, dht12.getHumidity10());
+    activity_manager.notify(WATCH_SENSORS);
+}
 
-    scan_grid_n++;
-    if (scan_grid_n > 4)
-        scan_grid_n = 0;
+static void dht12_read_routine()
+{
+    dht12.requestRead(dht12_on_read);
 }
+#endif
 
-static void display_render_routine()
+enum
 {
-    activity_manager.render();
+    TASK_PRIORITY_INPUT,
+    TASK_PRIORITY_TWI,
+    TASK_PRIORITY_RTC,
+    TASK_PRIORITY_ANIMATION,
+    TASK_PRIORITY_RENDER,
+    TASK_PRIORITY_LEDS,
+    TASK_PRIORITY_SENSORS,
+    TASK_PRIORITY_STORAGE,
+    TASK_PRIORITY_PROTOCOL,
+};
+
+task_t input_task = {/*run=*/input_routine, /*period_ms=*/10, /*priority=*/TASK_PRIORITY_INPUT};
+task_t twi_task = {/*run=*/twi_queue_poll, /*period_ms=*/5, /*priority=*/TASK_PRIORITY_TWI};
+task_t rtc_task = {/*run=*/rtc_task_routine, /*period_ms=*/50, /*priority=*/TASK_PRIORITY_RTC};
+task_t animation_task = {/*run=*/animation_routine, /*period_ms=*/10, /*priority=*/TASK_PRIORITY_ANIMATION};
+task_t marquee_task = {/*run=*/marquee_routine, /*period_ms=*/0, /*priority=*/TASK_PRIORITY_ANIMATION,
+                       /*flags=*/TASK_ONESHOT};
+task_t render_task = {/*run=*/display_render_routine, /*period_ms=*/0, /*priority=*/TASK_PRIORITY_RENDER,
+                      /*flags=*/TASK_ONESHOT};
+#ifdef FASTLED_ENABLED
+task_t backlight_task = {/*run=*/backlight_tick, /*period_ms=*/BACKLIGHT_TICK_MS, /*priority=*/TASK_PRIORITY_LEDS};
+#endif
+task_t ldr_task = {/*run=*/ldr_routine, /*period_ms=*/100, /*priority=*/TASK_PRIORITY_SENSORS};
+#ifdef DHT12_ENABLED
+task_t dht12_task = {/*run=*/dht12_read_routine, /*period_ms=*/10000, /*priority=*/TASK_PRIORITY_SENSORS};
+#endif
+task_t settings_task = {/*run=*/settings_flush, /*period_ms=*/0, /*priority=*/TASK_PRIORITY_STORAGE,
+                        /*flags=*/TASK_ONESHOT};
+task_t history_task = {/*run=*/history_flush, /*period_ms=*/0, /*priority=*/TASK_PRIORITY_STORAGE,
+                       /*flags=*/TASK_ONESHOT};
+#ifdef PROTOCOL_ENABLED
+task_t protocol_task = {/*run=*/protocol_poll, /*period_ms=*/10, /*priority=*/TASK_PRIORITY_PROTOCOL};
+#endif
+
+static void tasks_init()
+{
+    scheduler_add(&input_task);
+    scheduler_add(&twi_task);
+    scheduler_add(&rtc_task);
+    scheduler_add(&animation_task);
+    scheduler_add(&marquee_task);
+    scheduler_add(&render_task);
+#ifdef FASTLED_ENABLED
+    scheduler_add(&backlight_task);
+#endif
+    scheduler_add(&ldr_task);
+#ifdef DHT12_ENABLED
+    scheduler_add(&dht12_task);
+#endif
+    scheduler_add(&settings_task);
+    scheduler_add(&history_task);
+#ifdef PROTOCOL_ENABLED
+    scheduler_add(&protocol_task);
+#endif
 }
 
 void setup()
 {
-    pinMode(PIN_SR_DATA, OUTPUT);
-    pinMode(PIN_SR_LATCH, OUTPUT);
-    pinMode(PIN_SR_CLOCK, OUTPUT);
+    sr_init();
 
-    pinMode(PIN_LDR, INPUT);
+    settings_init(&settings_task);
+    history_init(&history_task);
+
+    ldr_init();
 
     pinMode(9, OUTPUT);
     digitalWrite(9, HIGH);
@@ -542,56 +979,50 @@ void setup()
 #ifdef FASTLED_ENABLED
     pinMode(PIN_WS21B_DATA, OUTPUT);
 
-    CFastLED::addLeds<WS2812B, PIN_WS21B_DATA, GRB>(leds, NUM_LEDS);
+    CFastLED::addLeds<WS2812B, PIN_WS21B_DATA, GRB>(backlight.leds, BACKLIGHT_LEDS);
     FastLED.setCorrection(CORRECTION);
     FastLED.setBrightness(BRIGHTNESS_HIGH);
     FastLED.setDither(LED_DITHER);
 
-    solid_color.hue = eeprom_read_byte((uint8_t *)EEPROM_ADDR_COLOR);
+    solid_color.hue = settings.hue;
     solid_color.saturation = 255;
-    BRIGHTNESS_HIGH = eeprom_read_byte((uint8_t *)EEPROM_ADDR_BRIGHTNESS);
+    BRIGHTNESS_HIGH = settings.brightness;
     solid_color.value = BRIGHTNESS_HIGH;
 
-    fastled_render_routine();
+    backlight_init(solid_color.hue, solid_color.saturation, solid_color.value);
+    backlight_set_effect(settings.effect, settings.effect_span);
+    backlight_tick();
 #endif
 
-    Wire.begin();
+    twi_queue_init();
 
-    pinMode(PIN_SQW, INPUT);
-    clock.setClockMode(false);
-    clock.enableOscillator(true, false, 0);
+    rtc_init();
+    rtc_sqw_init();
 
     _delay_ms(5);
-    MsTimer2::set(2, IV6_scan);
-    MsTimer2::start();
+    scan_stats_init();
+    scan_timer_start();
+
+#ifdef PROTOCOL_ENABLED
+    protocol_init();
+#endif
 
     encoder_init();
+    button_init();
+
+    text_marquee_init(&marquee_task);
 
     main_menu_activity.set_menu(&main_menu);
-    time_setup_activity.set_back_activity(&clock_activity);
-    time_setup_activity.set_clock(&clock);
-    color_setup_activity.set_back_activity(&clock_activity);
-    activity_manager.set_current(&clock_activity);
+    activity_manager.start(ACTIVITY_CLOCK, &render_task);
+
+    tasks_init();
+    power_init();
 }
 
 void loop()
 {
-    if (millis() - render_timer > 100)
-    {
-        now = RTClib::now();
-        render_timer = millis();
-        display_render_routine();
-        fastled_render_routine();
-        ldr_routine();
-    }
-
-#ifdef DHT12_ENABLED
-    if (millis() - temp_read_timer > 10000)
-    {
-        dht12.read();
-        temp_read_timer = millis();
-    }
-#endif
+    while (scheduler_run())
+        ;
 
-    encoder_routine();
+    power_idle();
 }
@@ -1,107 +1,335 @@
 #ifndef MENU_H
 #define MENU_H
 
-#include <DS3231.h>
+#include <avr/pgmspace.h>
+#include <string.h>
+
+#include "animation.h"
+#include "input.h"
+#include "text.h"
+#include "rtc.h"
+#include "scheduler.h"
+
+/*
+* Activities and navigation.
+*
+* Every activity is a static instance registered under an ACTIVITY_* id.
+* The manager keeps a bounded stack of ids: push() opens an activity on
+* top, pop() (long press by default) resumes the one below, home() goes
+* back to the root. Calls into the current activity go through the
+* activity_*() switches next to the instances, each case calls the
+* concrete class, so there is no vtable and the compiler can inline.
+* Activity<> and MenuActivity<> are CRTP bases with the default handlers.
+*
+* Menus are tables in flash with their exact size, see menu_of().
+*
+* Rendering is event driven: invalidate() arms the one-shot render task,
+* nothing renders while no state changed. Input and navigation invalidate
+* on their own. Time and sensor updates go through notify(), only an
+* activity that watches() the source is rendered again.
+*/
 
 enum
 {
-    ENCODER_ROTATION_RIGHT,
-    ENCODER_ROTATION_LEFT,
+    ACTIVITY_CLOCK,
+    ACTIVITY_MAIN_MENU,
+    ACTIVITY_TIME_SETUP,
+    ACTIVITY_COLOR_SETUP,
+    ACTIVITY_HISTORY,
 };
 
-class ActivityManager;
+#define ACTIVITY_STACK_SIZE 4
 
-class Activity
+// sources of notify()
+enum
+{
+    WATCH_TIME = 1 << 0,
+    WATCH_SENSORS = 1 << 1,
+};
+
+// static dispatch, defined with the instances
+static void activity_init(uint8_t id);
+static void activity_resume(uint8_t id);
+static void activity_render(uint8_t id);
+static void activity_tick(uint8_t id);
+static void activity_animation_done(uint8_t id);
+static void activity_rotate(uint8_t id, int8_t delta);
+static void activity_event(uint8_t id, uint8_t type);
+static bool activity_rotate_accelerated(uint8_t id);
+static uint8_t activity_watches(uint8_t id);
+
+/* `value` moved by `delta` within 0..size - 1, wrapping around */
+static uint8_t menu_wrap(uint8_t value, int8_t delta, uint8_t size)
+{
+    int16_t moved = ((int16_t)value + delta) % size;
+    if (moved < 0)
+        moved += size;
+
+    return moved;
+}
+
+class ActivityManager
 {
   public:
-    virtual void init() = 0;
-    virtual void render() = 0;
-    virtual void rotate(uint8_t direction) = 0;
-    virtual void press() = 0;
+    uint8_t current() const
+    {
+        return this->stack[this->depth - 1];
+    }
 
-    explicit Activity(ActivityManager *activity_manager)
+    /* Makes `root` the bottom of an empty stack, `render_task` is one-shot */
+    void start(uint8_t root, task_t *render_task)
     {
-        this->_activity_manager = activity_manager;
-        this->_back_activity = nullptr;
+        this->render_task = render_task;
+        this->depth = 0;
+        this->push(root);
     }
 
-    void set_back_activity(Activity *back_activity)
+    /* The current activity changed state, renders it from the scheduler */
+    void invalidate()
     {
-        this->_back_activity = back_activity;
+        scheduler_arm(this->render_task, 0);
     }
 
-  protected:
-    ActivityManager *_activity_manager;
-    Activity *_back_activity;
+    /* `source` (WATCH_*) has news, for the activity if it watches it */
+    void notify(uint8_t source)
+    {
+        if (activity_watches(this->current()) & source)
+            this->invalidate();
+    }
+
+    /* Opens the activity on top, false if the stack is full */
+    bool push(uint8_t activity, uint8_t transition = ANIMATION_NONE)
+    {
+        if (this->depth >= ACTIVITY_STACK_SIZE)
+            return false;
+
+        activity_init(activity);
+        this->stack[this->depth++] = activity;
+        this->transition(transition);
+
+        return true;
+    }
+
+    /* Resumes the activity below the current one, the root stays */
+    void pop(uint8_t transition = ANIMATION_NONE)
+    {
+        if (this->depth <= 1)
+            return;
+
+        this->depth--;
+        this->transition(transition);
+    }
+
+    void home(uint8_t transition = ANIMATION_NONE)
+    {
+        if (this->depth <= 1)
+            return;
+
+        this->depth = 1;
+        this->transition(transition);
+    }
+
+    /* Goes back to the activity if it is on the stack, pushes it otherwise */
+    void open(uint8_t activity, uint8_t transition = ANIMATION_NONE)
+    {
+        for (uint8_t i = 0; i < this->depth; i++)
+        {
+            if (this->stack[i] == activity)
+            {
+                this->depth = i + 1;
+                this->transition(transition);
+                return;
+            }
+        }
+
+        this->push(activity, transition);
+    }
+
+    void render() const
+    {
+        activity_render(this->current());
+    }
+
+    /* Passes a clock tick on to the current activity */
+    void tick()
+    {
+        activity_tick(this->current());
+    }
+
+    /* The display is free again, renders the current activity */
+    void animation_done()
+    {
+        activity_animation_done(this->current());
+        this->invalidate();
+    }
+
+    /*
+      Drains the input queue, at most one queue full per call. Detents in a
+      row are summed into one rotate() call, every other event flushes them
+      first so the order holds even when an event switches the activity.
+    */
+    void handle_input()
+    {
+        input_event_t event;
+        int8_t delta = 0;
+
+        for (uint8_t i = 0; i < INPUT_QUEUE_SIZE && input.queue.pop(&event); i++)
+        {
+            if (event.type == INPUT_ROTATE)
+            {
+                const uint8_t weight = activity_rotate_accelerated(this->current()) ? event.weight : 1;
+                delta = input_saturate(delta + event.value * weight);
+                continue;
+            }
+
+            this->rotate(delta);
+            delta = 0;
+
+            activity_event(this->current(), event.type);
+            this->invalidate();
+        }
+
+        this->rotate(delta);
+    }
+
+  private:
+    /*
+      Stops whatever plays on the display and optionally animates from the
+      current frame to the first frame of the new current activity.
+    */
+    void transition(uint8_t transition)
+    {
+        animation_clear();
+        text_marquee_stop();
+        activity_resume(this->current());
+        this->invalidate();
+
+        if (transition == ANIMATION_NONE)
+            return;
+
+        uint8_t from[DISPLAY_DIGITS];
+        memcpy(from, display.symbols, DISPLAY_DIGITS);
+
+        activity_render(this->current());
+        animation_queue(display.symbols, transition, ANIMATION_STEP_MS, 0);
+
+        memcpy(display.symbols, from, DISPLAY_DIGITS);
+    }
+
+    void rotate(int8_t delta)
+    {
+        if (delta == 0)
+            return;
+
+        activity_rotate(this->current(), delta);
+        this->invalidate();
+    }
+
+    uint8_t stack[ACTIVITY_STACK_SIZE];
+    uint8_t depth;
+    task_t *render_task;
 };
 
-class ActivityManager
+ActivityManager activity_manager;
+
+template <typename Derived>
+class Activity
 {
   public:
-    Activity *current_activity;
+    // defaults, a derived class hides the ones it handles
+    void init() {}
+
+    // every time it becomes the current activity, after init() on a push
+    void resume() {}
 
-    void set_current(Activity *activity)
+    void long_press()
     {
-        activity->init();
-        this->current_activity = activity;
+        activity_manager.pop(ANIMATION_SCROLL_RIGHT);
     }
 
-    void render() const
+    // reported after the press of its first click
+    void double_click() {}
+
+    // every BUTTON_REPEAT_MS while held after a long press
+    void repeat() {}
+
+    // rotate() gets accelerated steps instead of plain detents
+    static bool rotate_accelerated()
+    {
+        return false;
+    }
+
+    // WATCH_* sources that change what render() shows
+    static uint8_t watches()
     {
-        this->current_activity->render();
+        return 0;
+    }
+
+    // on every SQW level change while it is the current activity, timed
+    // state changes go here, render() only draws
+    void tick() {}
+
+    // an animation, its own or a transition, left the display
+    void animation_done() {}
+
+    void event(uint8_t type)
+    {
+        Derived *self = static_cast<Derived *>(this);
+
+        switch (type)
+        {
+        case INPUT_CLICK:
+            self->press();
+            break;
+        case INPUT_DOUBLE_CLICK:
+            self->double_click();
+            break;
+        case INPUT_LONG_PRESS:
+            self->long_press();
+            break;
+        case INPUT_REPEAT:
+            self->repeat();
+            break;
+        }
     }
 };
 
-typedef struct _menu_item
+struct menu_item_t
 {
     uint8_t title;
-    Activity *activity;
-
-    void (*callback)();
-
-} menu_item_t;
+    uint8_t activity;
+};
 
-typedef struct _menu
+// both live in flash
+struct menu_t
 {
     uint8_t size;
-    menu_item_t items[10];
-} menu_t;
+    const menu_item_t *items;
+};
+
+template <uint8_t N>
+constexpr menu_t menu_of(const menu_item_t (&items)[N])
+{
+    return {N, items};
+}
 
-class MenuActivity : public Activity
+template <typename Derived>
+class MenuActivity : public Activity<Derived>
 {
   public:
-    using Activity::Activity;
+    void rotate(int8_t delta)
+    {
+        this->_index = menu_wrap(this->_index, delta, pgm_read_byte(&this->menu->size));
+    }
 
-    void init() override = 0;
-    void render() override = 0;
-    void rotate(uint8_t direction) override
+    void press()
     {
-        if (direction == ENCODER_ROTATION_LEFT)
-        {
-            if (this->_index > 0)
-                this->_index--;
-            else
-                this->_index = this->menu->size - 1;
-        }
-        else if (direction == ENCODER_ROTATION_RIGHT)
-        {
-            if (this->_index < this->menu->size - 1)
-                this->_index++;
-            else
-                this->_index = 0;
-        }
+        activity_manager.open(pgm_read_byte(&this->item()->activity), ANIMATION_SCROLL_LEFT);
     }
 
-    void press() override
+    uint8_t title() const
     {
-        if (this->menu->items[this->_index].activity != nullptr)
-        {
-            this->_activity_manager->set_current(this->menu->items[this->_index].activity);
-        }
-        else if (this->menu->items[this->_index].callback != nullptr)
-        {
-            this->menu->items[this->_index].callback();
-        }
+        return pgm_read_byte(&this->item()->title);
     }
 
     void set_index(uint8_t index)
@@ -119,33 +347,47 @@ class MenuActivity : public Activity
         this->menu = _menu;
     }
 
+  protected:
+    const menu_item_t *item() const
+    {
+        return (const menu_item_t *)pgm_read_ptr(&this->menu->items) + this->_index;
+    }
+
     const menu_t *menu;
     uint8_t _index = 0;
 };
 
-class ClockActivity : public Activity
+class ClockActivity : public Activity<ClockActivity>
 {
   public:
-    using Activity::Activity;
+    void resume();
+    void render();
+    void rotate(int8_t delta);
+    void press();
+    void tick();
 
-    void init() override{};
-    void render() override;
-    void rotate(uint8_t direction) override;
-    void press() override;
+    void animation_done()
+    {
+        this->resume();
+    }
+
+    static uint8_t watches()
+    {
+        return WATCH_TIME | WATCH_SENSORS;
+    }
 
   private:
-    unsigned long int mode_render_timer;
-    uint8_t mode = 0;
+    void time_symbols(uint8_t *symbols, bool separator);
+    void temperature_symbols(uint8_t *symbols);
+
+    // millis() when the time came on the display
+    unsigned long int time_shown;
 };
 
-class MainMenuActivity : public MenuActivity
+class MainMenuActivity : public MenuActivity<MainMenuActivity>
 {
   public:
-    using MenuActivity::MenuActivity;
-
-    void init() override{};
-
-    void render() override;
+    void render();
 };
 
 enum
@@ -154,68 +396,35 @@ enum
     TIME_SETUP_MODE_MINUTE,
 };
 
-class TimeSetupActivity : public Activity
+class TimeSetupActivity : public Activity<TimeSetupActivity>
 {
   public:
-    using Activity::Activity;
-
-    void init() override
+    void init()
     {
         this->mode = TIME_SETUP_MODE_HOUR;
 
-        bool clock_h12 = false;
-        bool clock_PM = false;
+        const rtc_time_t now = rtc_now();
 
-        this->hour = this->_clock->getHour(clock_h12, clock_PM);
-        this->minute = this->_clock->getMinute();
+        this->hour = now.hour;
+        this->minute = now.minute;
     }
 
-    void render() override;
+    void render();
 
-    void set_clock(DS3231 *clk)
+    void rotate(int8_t delta)
     {
-        this->_clock = clk;
+        if (this->mode == TIME_SETUP_MODE_HOUR)
+            this->hour = menu_wrap(this->hour, delta, 24);
+        else if (this->mode == TIME_SETUP_MODE_MINUTE)
+            this->minute = menu_wrap(this->minute, delta, 60);
     }
 
-    void rotate(uint8_t direction) override
+    static bool rotate_accelerated()
     {
-        if (this->mode == TIME_SETUP_MODE_HOUR)
-        {
-            if (direction == ENCODER_ROTATION_RIGHT)
-            {
-                if (this->hour < 23)
-                    this->hour = this->hour + 1;
-                else
-                    this->hour = 0;
-            }
-            else
-            {
-                if (this->hour > 0)
-                    this->hour = this->hour - 1;
-                else
-                    this->hour = 23;
-            }
-        }
-        else if (this->mode == TIME_SETUP_MODE_MINUTE)
-        {
-            if (direction == ENCODER_ROTATION_RIGHT)
-            {
-                if (this->minute < 59)
-                    this->minute++;
-                else
-                    this->minute = 0;
-            }
-            else
-            {
-                if (this->minute > 0)
-                    this->minute--;
-                else
-                    this->minute = 59;
-            }
-        }
+        return true;
     }
 
-    void press() override
+    void press()
     {
         if (this->mode == TIME_SETUP_MODE_HOUR)
         {
@@ -224,11 +433,7 @@ class TimeSetupActivity : public Activity
         else if (this->mode == TIME_SETUP_MODE_MINUTE)
         {
             this->write_time();
-
-            if (this->_back_activity != nullptr)
-            {
-                this->_activity_manager->set_current(_back_activity);
-            }
+            activity_manager.home(ANIMATION_SCROLL_RIGHT);
         }
         else
         {
@@ -238,14 +443,10 @@ class TimeSetupActivity : public Activity
 
     void write_time()
     {
-        this->_clock->setHour(this->hour);
-        this->_clock->setMinute(this->minute);
-        this->_clock->setSecond(0);
+        rtc_set_time(this->hour, this->minute, 0);
     }
 
   private:
-    DS3231 *_clock;
-
     uint8_t mode;
     uint8_t hour;
     uint8_t minute;
@@ -257,53 +458,21 @@ enum
     COLOR_SETUP_MODE_BRIGHTNESS,
 };
 
-class ColorSetupActivity : public Activity
+class ColorSetupActivity : public Activity<ColorSetupActivity>
 {
   public:
-    using Activity::Activity;
-
-    void init() override;
-    void render() override;
+    void init();
+    void render();
 
-    void rotate(uint8_t direction) override
+    void rotate(int8_t delta)
     {
         if (this->mode == COLOR_SETUP_MODE_COLOR)
-        {
-            if (direction == ENCODER_ROTATION_RIGHT)
-            {
-                if (this->color < 6)
-                    this->color = this->color + 1;
-                else
-                    this->color = 0;
-            }
-            else
-            {
-                if (this->color > 0)
-                    this->color = this->color - 1;
-                else
-                    this->color = 6;
-            }
-        }
+            this->color = menu_wrap(this->color, delta, 7);
         else if (this->mode == COLOR_SETUP_MODE_BRIGHTNESS)
-        {
-            if (direction == ENCODER_ROTATION_RIGHT)
-            {
-                if (this->brighness < 9)
-                    this->brighness++;
-                else
-                    this->brighness = 0;
-            }
-            else
-            {
-                if (this->brighness > 0)
-                    this->brighness--;
-                else
-                    this->brighness = 9;
-            }
-        }
+            this->brighness = menu_wrap(this->brighness, delta, 10);
     }
 
-    void press() override
+    void press()
     {
         if (this->mode == COLOR_SETUP_MODE_COLOR)
         {
@@ -312,11 +481,7 @@ class ColorSetupActivity : public Activity
         else if (this->mode == COLOR_SETUP_MODE_BRIGHTNESS)
         {
             this->write_color();
-
-            if (this->_back_activity != nullptr)
-            {
-                this->_activity_manager->set_current(_back_activity);
-            }
+            activity_manager.home(ANIMATION_SCROLL_RIGHT);
         }
         else
         {
@@ -333,4 +498,60 @@ class ColorSetupActivity : public Activity
     uint8_t brighness;
 };
 
+#define HISTORY_VIEW_MS 3000
+
+enum
+{
+    HISTORY_VIEW_TEMPERATURE_MIN,
+    HISTORY_VIEW_TEMPERATURE_MAX,
+    HISTORY_VIEW_TEMPERATURE_TREND,
+    HISTORY_VIEW_HUMIDITY_MIN,
+    HISTORY_VIEW_HUMIDITY_MAX,
+    HISTORY_VIEW_HUMIDITY_TREND,
+    HISTORY_VIEWS,
+};
+
+/* Cycles through the 24 hour extremes and trends, turning picks a view and names it */
+class HistoryActivity : public Activity<HistoryActivity>
+{
+  public:
+    void init()
+    {
+        this->show(HISTORY_VIEW_TEMPERATURE_MIN);
+    }
+
+    void render();
+
+    void rotate(int8_t delta)
+    {
+        this->pick(menu_wrap(this->view, delta, HISTORY_VIEWS));
+    }
+
+    void press()
+    {
+        this->rotate(1);
+    }
+
+    void tick();
+
+    // the SQW ticks drive the cycling
+    static uint8_t watches()
+    {
+        return WATCH_TIME | WATCH_SENSORS;
+    }
+
+  private:
+    void show(uint8_t view)
+    {
+        this->view = view;
+        this->view_timer = millis();
+    }
+
+    // a view picked by hand scrolls its full name first
+    void pick(uint8_t view);
+
+    unsigned long int view_timer;
+    uint8_t view;
+};
+
 #endif
\ No newline at end of file
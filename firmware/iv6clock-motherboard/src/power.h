@@ -0,0 +1,91 @@
+#ifndef IV6CLOCK_MOTHERBOARD_POWER_H
+#define IV6CLOCK_MOTHERBOARD_POWER_H
+
+#include <Arduino.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+
+#include "scheduler.h"
+
+/*
+* Idle between scheduled work.
+*
+* Once the scheduler has nothing due, power_idle() puts the CPU into
+* SLEEP_MODE_IDLE. Timer0 (millis), the Timer2 scan and every other
+* interrupt keep running and wake it up, so at the latest the next millis
+* tick brings loop() back to check the tasks.
+*
+* Peripherals the firmware never uses are powered down through PRR.
+*
+* Duty cycle is the share of wall time loop() spends awake, measured with
+* micros() over POWER_WINDOW_MS windows. Time spent in ISRs while sleeping
+* counts as idle.
+*/
+
+#define POWER_WINDOW_MS 1000
+
+struct power_t
+{
+    unsigned long wake_us;
+    unsigned long active_us;
+    unsigned long window_start;
+    uint16_t duty_permille;
+};
+
+power_t power;
+
+static void power_init()
+{
+    // in use: Timer0 (millis), Timer2 (scan), TWI, ADC (LDR)
+    power_spi_disable();
+#ifndef SCAN_STATS
+    // Timer1 carries the scan instrumentation
+    power_timer1_disable();
+#endif
+    // unless the serial port or the shift register backend set it up
+    if (UCSR0B == 0)
+        power_usart0_disable();
+
+    // analog comparator off
+    ACSR = _BV(ACD);
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+    power.wake_us = micros();
+    power.window_start = power.wake_us;
+}
+
+static void power_idle()
+{
+    const unsigned long now = micros();
+    power.active_us += now - power.wake_us;
+
+    if (now - power.window_start >= POWER_WINDOW_MS * 1000UL)
+    {
+        power.duty_permille = power.active_us / ((now - power.window_start) / 1000);
+        power.active_us = 0;
+        power.window_start = now;
+    }
+
+    cli();
+    // only "nothing due" matters, the clamp of a far wake does not
+    if (scheduler_next_wake() != 0)
+    {
+        sleep_enable();
+        // the instruction after sei is executed before any interrupt
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+
+    power.wake_us = micros();
+}
+
+/* Share of time loop() was awake over the last window, 0.1 % */
+static inline uint16_t power_duty_permille()
+{
+    return power.duty_permille;
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_POWER_H
@@ -0,0 +1,314 @@
+#ifndef IV6CLOCK_MOTHERBOARD_PROTOCOL_H
+#define IV6CLOCK_MOTHERBOARD_PROTOCOL_H
+
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#include "uart.h"
+
+/*
+* Binary command protocol on the serial port, tools/iv6link.py is the host
+* side.
+*
+* Frames look the same in both directions
+*
+*   sync        PROTOCOL_SYNC
+*   length      payload bytes, at most PROTOCOL_PAYLOAD_MAX
+*   command
+*   payload     multi byte values little endian
+*   crc         CRC-8 (CCITT) of length, command and payload
+*
+* The host sends one command at a time. The clock answers with
+* command | PROTOCOL_REPLY and the result, or with PROTOCOL_ERROR carrying
+* the command and a PROTOCOL_ERROR_* code. A frame with a bad CRC, or one
+* that stalls for PROTOCOL_TIMEOUT_MS, is dropped without an answer and
+* the parser looks for the next sync byte, the host retries after its own
+* timeout.
+*
+* protocol_poll() runs from a task and parses what has arrived. A complete
+* frame waits until the TX queue can take the longest answer, so answers
+* are never cut and a host that floods the port is held back by the RX
+* queue. PROTOCOL_PING and PROTOCOL_LOG_MASK are answered here, every
+* other command goes to protocol_command(), which main.cpp implements and
+* which builds its answer with protocol_put(). The answer is written over
+* the received payload, a command reads or copies its arguments before it
+* puts the first value.
+*
+* Logs
+*
+* PROTOCOL_LOG_MASK enables PROTOCOL_LOG_* sources, protocol_log() then
+* sends unsolicited PROTOCOL_LOG frames, the source is the first payload
+* byte. Log frames that do not fit into the TX queue, or entries too long
+* for a frame, are dropped and counted. Everything here runs in the main
+* loop, which is the only producer of the TX queue.
+*/
+
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_SYNC 0xA5
+#define PROTOCOL_PAYLOAD_MAX 40
+// sync, length, command, crc
+#define PROTOCOL_FRAME_MAX (PROTOCOL_PAYLOAD_MAX + 4)
+#define PROTOCOL_TIMEOUT_MS 100
+#define PROTOCOL_REPLY 0x80
+
+static_assert(PROTOCOL_FRAME_MAX <= UART_RX_SIZE, "a frame does not fit the RX queue");
+static_assert(PROTOCOL_FRAME_MAX <= UART_TX_SIZE, "a frame does not fit the TX queue");
+static_assert(PROTOCOL_PAYLOAD_MAX < PROTOCOL_SYNC, "lengths must not look like a sync byte");
+
+enum
+{
+    PROTOCOL_PING = 0x01,
+    PROTOCOL_LOG_MASK,
+    PROTOCOL_GET_TIME,
+    PROTOCOL_SET_TIME,
+    PROTOCOL_SENSORS,
+    PROTOCOL_GET_SETTINGS,
+    PROTOCOL_SET_SETTINGS,
+    PROTOCOL_TASK,
+    PROTOCOL_COUNTERS,
+    PROTOCOL_SCAN,
+    PROTOCOL_SCAN_SAMPLES,
+    PROTOCOL_HISTORY,
+
+    // from the clock only
+    PROTOCOL_LOG = 0x7E,
+    PROTOCOL_ERROR = 0x7F,
+};
+
+enum
+{
+    PROTOCOL_OK,
+    PROTOCOL_ERROR_COMMAND,
+    PROTOCOL_ERROR_LENGTH,
+    PROTOCOL_ERROR_ARGUMENT,
+    PROTOCOL_ERROR_BUSY,
+    PROTOCOL_ERROR_UNSUPPORTED,
+};
+
+// bits of the log mask
+enum
+{
+    PROTOCOL_LOG_SENSORS,
+    PROTOCOL_LOG_AMBIENT,
+};
+
+enum
+{
+    PROTOCOL_WAIT_SYNC,
+    PROTOCOL_WAIT_LENGTH,
+    PROTOCOL_WAIT_COMMAND,
+    PROTOCOL_WAIT_PAYLOAD,
+    PROTOCOL_WAIT_CRC,
+    PROTOCOL_FRAME_DONE,
+};
+
+struct protocol_t
+{
+    // frame being received
+    uint8_t state;
+    uint8_t length;
+    uint8_t command;
+    uint8_t received;
+    uint8_t crc;
+    // the answer once the frame is done
+    uint8_t payload[PROTOCOL_PAYLOAD_MAX];
+    uint8_t reply_length;
+    // millis() at the last byte
+    unsigned long byte_time;
+
+    uint8_t log_mask;
+
+    // saturate
+    uint16_t crc_errors;
+    uint16_t timeouts;
+    uint16_t log_drops;
+};
+
+protocol_t protocol;
+
+/* Handles `command`, returns PROTOCOL_OK or a PROTOCOL_ERROR_* code */
+static uint8_t protocol_command(uint8_t command, const uint8_t *payload, uint8_t length);
+
+static void protocol_init()
+{
+    uart_init();
+}
+
+static inline void protocol_count(uint16_t *counter)
+{
+    if (*counter != 0xFFFF)
+        (*counter)++;
+}
+
+static void protocol_put_bytes(const void *data, uint8_t length)
+{
+    if (protocol.reply_length + length > PROTOCOL_PAYLOAD_MAX)
+        return;
+
+    memcpy(protocol.payload + protocol.reply_length, data, length);
+    protocol.reply_length += length;
+}
+
+/* Appends `value` to the answer, the AVR is little endian like the wire */
+template <typename T>
+static inline void protocol_put(T value)
+{
+    protocol_put_bytes(&value, sizeof(value));
+}
+
+static uint8_t protocol_send_bytes(uint8_t crc, const uint8_t *data, uint8_t length)
+{
+    for (uint8_t i = 0; i < length; i++)
+    {
+        uart_write(data[i]);
+        crc = _crc8_ccitt_update(crc, data[i]);
+    }
+
+    return crc;
+}
+
+/*
+* Sends `head` and then `payload` as the payload of one frame. The caller
+* checks that the TX queue has room for the whole frame.
+*/
+static void protocol_send(uint8_t command, const uint8_t *head, uint8_t head_length,
+                          const uint8_t *payload, uint8_t length)
+{
+    uint8_t crc = _crc8_ccitt_update(0, head_length + length);
+    crc = _crc8_ccitt_update(crc, command);
+
+    uart_write(PROTOCOL_SYNC);
+    uart_write(head_length + length);
+    uart_write(command);
+    crc = protocol_send_bytes(crc, head, head_length);
+    crc = protocol_send_bytes(crc, payload, length);
+    uart_write(crc);
+}
+
+static void protocol_log(uint8_t source, const void *data, uint8_t length)
+{
+    if (!(protocol.log_mask & _BV(source)))
+        return;
+
+    // the source byte takes one of the payload
+    if (length >= PROTOCOL_PAYLOAD_MAX || uart_tx_space() < length + 5)
+    {
+        protocol_count(&protocol.log_drops);
+        return;
+    }
+
+    protocol_send(PROTOCOL_LOG, &source, 1, (const uint8_t *)data, length);
+}
+
+static void protocol_receive(uint8_t value)
+{
+    switch (protocol.state)
+    {
+    case PROTOCOL_WAIT_SYNC:
+        if (value == PROTOCOL_SYNC)
+            protocol.state = PROTOCOL_WAIT_LENGTH;
+        break;
+    case PROTOCOL_WAIT_LENGTH:
+        // a second sync byte may start the real frame
+        if (value > PROTOCOL_PAYLOAD_MAX)
+        {
+            protocol.state = value == PROTOCOL_SYNC ? PROTOCOL_WAIT_LENGTH : PROTOCOL_WAIT_SYNC;
+            break;
+        }
+
+        protocol.length = value;
+        protocol.crc = _crc8_ccitt_update(0, value);
+        protocol.state = PROTOCOL_WAIT_COMMAND;
+        break;
+    case PROTOCOL_WAIT_COMMAND:
+        protocol.command = value;
+        protocol.crc = _crc8_ccitt_update(protocol.crc, value);
+        protocol.received = 0;
+        protocol.state = protocol.length != 0 ? PROTOCOL_WAIT_PAYLOAD : PROTOCOL_WAIT_CRC;
+        break;
+    case PROTOCOL_WAIT_PAYLOAD:
+        protocol.payload[protocol.received++] = value;
+        protocol.crc = _crc8_ccitt_update(protocol.crc, value);
+        if (protocol.received == protocol.length)
+            protocol.state = PROTOCOL_WAIT_CRC;
+        break;
+    case PROTOCOL_WAIT_CRC:
+        if (value == protocol.crc)
+        {
+            protocol.state = PROTOCOL_FRAME_DONE;
+            break;
+        }
+
+        protocol_count(&protocol.crc_errors);
+        protocol.state = PROTOCOL_WAIT_SYNC;
+        break;
+    }
+}
+
+static uint8_t protocol_builtin(uint8_t command, const uint8_t *payload, uint8_t length)
+{
+    switch (command)
+    {
+    case PROTOCOL_PING:
+        protocol_put<uint8_t>(PROTOCOL_VERSION);
+        protocol_put<uint8_t>(PROTOCOL_PAYLOAD_MAX);
+        protocol_put<uint32_t>(millis());
+        return PROTOCOL_OK;
+    case PROTOCOL_LOG_MASK:
+        if (length > 1)
+            return PROTOCOL_ERROR_LENGTH;
+
+        // without a payload the mask is only read back
+        if (length == 1)
+            protocol.log_mask = payload[0];
+        protocol_put<uint8_t>(protocol.log_mask);
+        return PROTOCOL_OK;
+    }
+
+    return protocol_command(command, payload, length);
+}
+
+static void protocol_dispatch()
+{
+    protocol.state = PROTOCOL_WAIT_SYNC;
+    protocol.reply_length = 0;
+
+    const uint8_t error = protocol_builtin(protocol.command, protocol.payload, protocol.length);
+    if (error == PROTOCOL_OK)
+    {
+        protocol_send(protocol.command | PROTOCOL_REPLY, NULL, 0, protocol.payload, protocol.reply_length);
+        return;
+    }
+
+    const uint8_t answer[] = {protocol.command, error};
+    protocol_send(PROTOCOL_ERROR, NULL, 0, answer, sizeof(answer));
+}
+
+static void protocol_poll()
+{
+    for (;;)
+    {
+        if (protocol.state == PROTOCOL_FRAME_DONE)
+        {
+            if (uart_tx_space() < PROTOCOL_FRAME_MAX)
+                return;
+
+            protocol_dispatch();
+        }
+
+        uint8_t value;
+        if (!uart_read(&value))
+            break;
+
+        protocol.byte_time = millis();
+        protocol_receive(value);
+    }
+
+    if (protocol.state != PROTOCOL_WAIT_SYNC && millis() - protocol.byte_time > PROTOCOL_TIMEOUT_MS)
+    {
+        protocol_count(&protocol.timeouts);
+        protocol.state = PROTOCOL_WAIT_SYNC;
+    }
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_PROTOCOL_H
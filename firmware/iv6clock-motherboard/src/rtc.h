@@ -0,0 +1,295 @@
+#ifndef IV6CLOCK_MOTHERBOARD_RTC_H
+#define IV6CLOCK_MOTHERBOARD_RTC_H
+
+#include <Arduino.h>
+#include <util/atomic.h>
+#include <TwiQueue.h>
+
+/*
+* DS3231 over the TwiQueue.
+*
+* rtc_request_read() queues a read of the seconds, minutes and hours
+* registers and returns at once, `rtc.time` is updated from the
+* completion callback. Writes are queued the same way.
+*
+* Timekeeping
+*
+* The time is kept locally: the 1 Hz SQW output raises PCINT2 and every
+* falling edge, where the DS3231 updates its seconds register, advances
+* `rtc.time` by one second. The registers are read back only once a minute
+* or after rtc_resync(), instead of being polled. If SQW stops toggling the
+* time is polled every RTC_POLL_MS until it comes back.
+*
+* `rtc.time` is shared with the ISR, use rtc_now() for a consistent copy.
+* It counts from 00:00:00 until the first read is taken over or the time
+* is set, rtc_valid() tells when it is the real time.
+* `rtc.changes` counts every SQW level change and every time read back,
+* rtc_changed() tells the main loop that something on the clock moved.
+*/
+
+#define DS3231_ADDRESS 0x68
+
+#define DS3231_REG_SECONDS 0x00
+#define DS3231_REG_CONTROL 0x0E
+
+#define DS3231_HOUR_12 0x40
+#define DS3231_HOUR_PM 0x20
+
+#define PIN_SQW 10 //PB2
+
+// no SQW edge for this long means SQW is not running
+#define RTC_SQW_TIMEOUT_MS 1500
+#define RTC_POLL_MS 1000
+
+struct rtc_time_t
+{
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+};
+
+struct rtc_t
+{
+    volatile rtc_time_t time;
+    // set by the first read taken over or rtc_set_time()
+    volatile uint8_t valid;
+
+    volatile uint8_t sqw_level;
+    volatile uint8_t edges;
+    volatile uint8_t changes;
+    uint8_t seen_changes;
+    volatile uint8_t resync;
+    volatile unsigned long edge_time;
+
+    uint8_t read_edges;
+    unsigned long poll_timer;
+
+    uint8_t read_reg;
+    uint8_t read_buf[3];
+    uint8_t write_buf[4];
+    twi_transaction_t read_transaction;
+    twi_transaction_t write_transaction;
+};
+
+rtc_t rtc;
+
+static inline uint8_t bcd2bin(uint8_t value)
+{
+    return value - 6 * (value >> 4);
+}
+
+static inline uint8_t bin2bcd(uint8_t value)
+{
+    return value + 6 * (value / 10);
+}
+
+static rtc_time_t rtc_now()
+{
+    rtc_time_t time;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        time.hour = rtc.time.hour;
+        time.minute = rtc.time.minute;
+        time.second = rtc.time.second;
+    }
+
+    return time;
+}
+
+static inline bool rtc_valid()
+{
+    return rtc.valid;
+}
+
+/* Queues a resync with the DS3231 registers */
+static inline void rtc_resync()
+{
+    rtc.resync = 1;
+}
+
+static void rtc_on_read(twi_transaction_t *transaction)
+{
+    if (transaction->status != TWI_STATUS_OK)
+    {
+        rtc_resync();
+        return;
+    }
+
+    rtc_time_t time;
+    time.second = bcd2bin(rtc.read_buf[0] & 0x7F);
+    time.minute = bcd2bin(rtc.read_buf[1]);
+
+    const uint8_t hour = rtc.read_buf[2];
+    if (hour & DS3231_HOUR_12)
+        time.hour = bcd2bin(hour & 0x1F) % 12 + (hour & DS3231_HOUR_PM ? 12 : 0);
+    else
+        time.hour = bcd2bin(hour & 0x3F);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        // a second went by or the time was set since the read was queued,
+        // the result may be stale
+        if (rtc.edges != rtc.read_edges)
+        {
+            rtc.resync = 1;
+        }
+        else
+        {
+            rtc.time.hour = time.hour;
+            rtc.time.minute = time.minute;
+            rtc.time.second = time.second;
+            rtc.valid = 1;
+            rtc.changes++;
+        }
+    }
+}
+
+static bool rtc_request_read()
+{
+    rtc.read_reg = DS3231_REG_SECONDS;
+    rtc.read_edges = rtc.edges;
+
+    twi_transaction_t *transaction = &rtc.read_transaction;
+    transaction->address = DS3231_ADDRESS;
+    transaction->tx = &rtc.read_reg;
+    transaction->tx_len = 1;
+    transaction->rx = rtc.read_buf;
+    transaction->rx_len = sizeof(rtc.read_buf);
+    transaction->callback = rtc_on_read;
+
+    return twi_queue_post(transaction);
+}
+
+static bool rtc_write(uint8_t len)
+{
+    twi_transaction_t *transaction = &rtc.write_transaction;
+    transaction->address = DS3231_ADDRESS;
+    transaction->tx = rtc.write_buf;
+    transaction->tx_len = len;
+    transaction->rx_len = 0;
+
+    return twi_queue_post(transaction);
+}
+
+/* Oscillator on, 1 Hz square wave on SQW, alarms off */
+static bool rtc_init()
+{
+    if (rtc.write_transaction.status == TWI_STATUS_PENDING)
+        return false;
+
+    rtc.write_buf[0] = DS3231_REG_CONTROL;
+    rtc.write_buf[1] = 0x00;
+
+    return rtc_write(2);
+}
+
+/* Sets the time in 24 hour mode */
+static bool rtc_set_time(uint8_t hour, uint8_t minute, uint8_t second)
+{
+    if (rtc.write_transaction.status == TWI_STATUS_PENDING)
+        return false;
+
+    rtc.write_buf[0] = DS3231_REG_SECONDS;
+    rtc.write_buf[1] = bin2bcd(second);
+    rtc.write_buf[2] = bin2bcd(minute);
+    rtc.write_buf[3] = bin2bcd(hour);
+
+    if (!rtc_write(4))
+        return false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        rtc.time.hour = hour;
+        rtc.time.minute = minute;
+        rtc.time.second = second;
+        rtc.valid = 1;
+
+        // a read queued before the write completes after it, rtc_on_read()
+        // takes it as stale and reads again
+        rtc.read_edges = rtc.edges - 1;
+    }
+
+    return true;
+}
+
+/***********************************
+* SQW timekeeping
+***********************************/
+
+static void rtc_sqw_init()
+{
+    pinMode(PIN_SQW, INPUT);
+    rtc.sqw_level = PINB & _BV(PB2);
+    rtc.resync = 1;
+
+    cli();
+    PCICR |= 1u << PCIE0;
+    PCMSK0 |= 1u << PCINT2;
+    sei();
+}
+
+/* Called from PCINT0_vect */
+static inline void rtc_sqw_edge()
+{
+    const uint8_t level = PINB & _BV(PB2);
+    if (level == rtc.sqw_level)
+        return;
+
+    rtc.sqw_level = level;
+    rtc.edge_time = millis();
+    rtc.changes++;
+
+    if (level)
+        return;
+
+    rtc.edges++;
+
+    if (++rtc.time.second < 60)
+        return;
+
+    rtc.time.second = 0;
+    rtc.resync = 1;
+
+    if (++rtc.time.minute < 60)
+        return;
+
+    rtc.time.minute = 0;
+
+    if (++rtc.time.hour < 24)
+        return;
+
+    rtc.time.hour = 0;
+}
+
+/* True once after every change of the time or the SQW level */
+static bool rtc_changed()
+{
+    const uint8_t changes = rtc.changes;
+    if (changes == rtc.seen_changes)
+        return false;
+
+    rtc.seen_changes = changes;
+    return true;
+}
+
+/* Resyncs on request and polls while SQW is not running, call it from loop() */
+static void rtc_routine()
+{
+    unsigned long edge_time;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        edge_time = rtc.edge_time;
+    }
+
+    if (millis() - edge_time > RTC_SQW_TIMEOUT_MS && millis() - rtc.poll_timer > RTC_POLL_MS)
+    {
+        rtc.poll_timer = millis();
+        rtc.resync = 1;
+    }
+
+    if (rtc.resync && rtc_request_read())
+        rtc.resync = 0;
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_RTC_H
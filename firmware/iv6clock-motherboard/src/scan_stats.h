@@ -0,0 +1,192 @@
+#ifndef IV6CLOCK_MOTHERBOARD_SCAN_STATS_H
+#define IV6CLOCK_MOTHERBOARD_SCAN_STATS_H
+
+#include <Arduino.h>
+#include <util/atomic.h>
+
+#include "display.h"
+
+/*
+* Multiplex scan instrumentation, off unless built with the flags below.
+*
+* -D SCAN_STATS
+*   Timer1 runs free at F_CPU and timestamps every scan ISR entry and
+*   exit. The nominal period is DISPLAY_SCAN_TICKS * 256 cycles, anything
+*   above it is latency added by code running with interrupts disabled.
+*   The last SCAN_STATS_RING samples are kept in a ring buffer, min/max/avg
+*   period and avg/max ISR duration are aggregated since the last reset.
+*   Timer1 wraps every 4 ms, so only the 16 bit differences are used.
+*   PROTOCOL_SCAN copies the aggregates under cli and can freeze the ring,
+*   the ISR then leaves it alone while PROTOCOL_SCAN_SAMPLES pages through
+*   it and the last page thaws it, so there is no second copy in SRAM.
+*   `tools/iv6link.py scan` prints them like tools/scan_vcd.py.
+*
+* -D SCAN_TRACE
+*   PIN_SCAN_TRACE (A3) is high while the scan ISR runs, for a logic
+*   analyser or a simavr VCD trace, see tools/scan_vcd.py.
+*/
+
+#define SCAN_STATS_RING 32
+#define SCAN_STATS_NOMINAL ((uint16_t)DISPLAY_SCAN_TICKS * 256)
+
+#define PIN_SCAN_TRACE_BIT PC3
+
+#if defined(SCAN_STATS) && SR_BACKEND == SR_BACKEND_USART
+#error "SCAN_STATS is read over the serial port, which needs USART0"
+#endif
+
+struct scan_sample_t
+{
+    uint16_t period;
+    uint16_t duration;
+};
+
+struct scan_totals_t
+{
+    uint32_t count;
+    // sum of period - SCAN_STATS_NOMINAL, does not overflow like the plain sum
+    int32_t period_deviation;
+    uint16_t period_min;
+    uint16_t period_max;
+    uint32_t duration_sum;
+    uint16_t duration_max;
+};
+
+struct scan_stats_t
+{
+    scan_sample_t ring[SCAN_STATS_RING];
+    uint8_t ring_head;
+    // set while the ring is read out, samples only go to the totals
+    uint8_t frozen;
+
+    uint16_t entry;
+    uint8_t started;
+
+    scan_totals_t totals;
+};
+
+#ifdef SCAN_STATS
+volatile scan_stats_t scan_stats;
+#endif
+
+static void scan_stats_init()
+{
+#ifdef SCAN_TRACE
+    DDRC |= _BV(PIN_SCAN_TRACE_BIT);
+    PORTC &= ~_BV(PIN_SCAN_TRACE_BIT);
+#endif
+
+#ifdef SCAN_STATS
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TIMSK1 = 0;
+#endif
+}
+
+/* First thing in the scan ISR */
+static inline void scan_stats_enter()
+{
+#ifdef SCAN_TRACE
+    PORTC |= _BV(PIN_SCAN_TRACE_BIT);
+#endif
+
+#ifdef SCAN_STATS
+    const uint16_t now = TCNT1;
+    const uint16_t period = now - scan_stats.entry;
+    scan_stats.entry = now;
+
+    if (!scan_stats.started)
+    {
+        scan_stats.started = 1;
+        if (!scan_stats.frozen)
+            scan_stats.ring[scan_stats.ring_head].period = 0;
+        return;
+    }
+
+    volatile scan_totals_t *totals = &scan_stats.totals;
+    if (!scan_stats.frozen)
+        scan_stats.ring[scan_stats.ring_head].period = period;
+    totals->count++;
+    totals->period_deviation += (int16_t)(period - SCAN_STATS_NOMINAL);
+    if (totals->count == 1 || period < totals->period_min)
+        totals->period_min = period;
+    if (period > totals->period_max)
+        totals->period_max = period;
+#endif
+}
+
+/* Last thing in the scan ISR */
+static inline void scan_stats_leave()
+{
+#ifdef SCAN_STATS
+    const uint16_t duration = TCNT1 - scan_stats.entry;
+
+    if (!scan_stats.frozen)
+    {
+        scan_stats.ring[scan_stats.ring_head].duration = duration;
+        scan_stats.ring_head = (scan_stats.ring_head + 1) % SCAN_STATS_RING;
+    }
+    scan_stats.totals.duration_sum += duration;
+    if (duration > scan_stats.totals.duration_max)
+        scan_stats.totals.duration_max = duration;
+#endif
+
+#ifdef SCAN_TRACE
+    PORTC &= ~_BV(PIN_SCAN_TRACE_BIT);
+#endif
+}
+
+#ifdef SCAN_STATS
+
+static void scan_stats_reset()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        scan_stats.started = 0;
+        scan_stats.totals.count = 0;
+        scan_stats.totals.period_deviation = 0;
+        scan_stats.totals.period_min = 0;
+        scan_stats.totals.period_max = 0;
+        scan_stats.totals.duration_sum = 0;
+        scan_stats.totals.duration_max = 0;
+    }
+}
+
+/* A consistent copy of the aggregates since the last reset */
+static void scan_stats_take_totals(scan_totals_t *totals)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        totals->count = scan_stats.totals.count;
+        totals->period_deviation = scan_stats.totals.period_deviation;
+        totals->period_min = scan_stats.totals.period_min;
+        totals->period_max = scan_stats.totals.period_max;
+        totals->duration_sum = scan_stats.totals.duration_sum;
+        totals->duration_max = scan_stats.totals.duration_max;
+    }
+}
+
+/* Stops or restarts filling the ring, one byte the ISR only reads */
+static inline void scan_stats_freeze(bool frozen)
+{
+    scan_stats.frozen = frozen;
+}
+
+/* Sample `index` of the ring, oldest first, pages only match while it is frozen */
+static scan_sample_t scan_stats_sample(uint8_t index)
+{
+    scan_sample_t copy;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        const volatile scan_sample_t *sample = &scan_stats.ring[(scan_stats.ring_head + index) % SCAN_STATS_RING];
+        copy.period = sample->period;
+        copy.duration = sample->duration;
+    }
+
+    return copy;
+}
+
+#endif
+
+#endif //IV6CLOCK_MOTHERBOARD_SCAN_STATS_H
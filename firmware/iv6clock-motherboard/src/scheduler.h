@@ -0,0 +1,171 @@
+#ifndef IV6CLOCK_MOTHERBOARD_SCHEDULER_H
+#define IV6CLOCK_MOTHERBOARD_SCHEDULER_H
+
+#include <Arduino.h>
+
+/*
+* Cooperative task scheduler.
+*
+* Tasks are statically allocated task_t globals registered once with
+* scheduler_add(). A periodic task becomes due every period_ms, a one-shot
+* task runs once per scheduler_arm(). scheduler_run() runs the due task with
+* the highest priority (lowest value) and returns, so loop() calls it until
+* nothing is due and then may sleep for scheduler_next_wake() ms.
+*
+* Deadline tracking: a task is due at `due` and must have started by
+* `due + period_ms` (one-shots: `due + SCHEDULER_ONESHOT_DEADLINE_MS`).
+* Starting later, or running for longer than its period, counts as an
+* overrun. A periodic task that fell behind is rescheduled from now
+* instead of running back to back to catch up.
+*/
+
+#define SCHEDULER_MAX_TASKS 14
+#define SCHEDULER_ONESHOT_DEADLINE_MS 10
+#define SCHEDULER_IDLE 0xFFFF
+
+enum
+{
+    TASK_PERIODIC = 0,
+    TASK_ONESHOT = 1 << 0,
+    TASK_ARMED = 1 << 1,
+};
+
+struct task_stats_t
+{
+    uint32_t runs;
+    uint32_t total_us;
+    uint16_t max_us;
+    uint16_t overruns;
+};
+
+struct task_t
+{
+    void (*run)();
+    uint16_t period_ms;
+    uint8_t priority;
+    uint8_t flags;
+
+    unsigned long due;
+    task_stats_t stats;
+};
+
+struct scheduler_t
+{
+    task_t *tasks[SCHEDULER_MAX_TASKS];
+    uint8_t count;
+};
+
+scheduler_t scheduler;
+
+/* Registers the task, periodic tasks are first due after `delay_ms` */
+static bool scheduler_add(task_t *task, uint16_t delay_ms = 0)
+{
+    if (scheduler.count >= SCHEDULER_MAX_TASKS)
+        return false;
+
+    task->due = millis() + delay_ms;
+    if (!(task->flags & TASK_ONESHOT))
+        task->flags |= TASK_ARMED;
+
+    scheduler.tasks[scheduler.count++] = task;
+
+    return true;
+}
+
+/* Schedules a registered task to run once after `delay_ms` */
+static void scheduler_arm(task_t *task, uint16_t delay_ms)
+{
+    task->due = millis() + delay_ms;
+    task->flags |= TASK_ARMED;
+}
+
+static inline void scheduler_disarm(task_t *task)
+{
+    task->flags &= ~TASK_ARMED;
+}
+
+static inline bool task_due(const task_t *task, unsigned long now)
+{
+    return (task->flags & TASK_ARMED) && (long)(now - task->due) >= 0;
+}
+
+static void scheduler_exec(task_t *task, unsigned long now)
+{
+    const uint16_t deadline = task->flags & TASK_ONESHOT ? SCHEDULER_ONESHOT_DEADLINE_MS : task->period_ms;
+    bool overrun = now - task->due > deadline;
+
+    if (task->flags & TASK_ONESHOT)
+    {
+        task->flags &= ~TASK_ARMED;
+    }
+    else
+    {
+        task->due += task->period_ms;
+        if ((long)(now - task->due) >= 0)
+            task->due = now + task->period_ms;
+    }
+
+    const unsigned long start = micros();
+    task->run();
+    const unsigned long elapsed = micros() - start;
+
+    if (task->period_ms != 0 && elapsed > task->period_ms * 1000UL)
+        overrun = true;
+
+    task_stats_t *stats = &task->stats;
+    stats->runs++;
+    stats->total_us += elapsed;
+    if (elapsed > stats->max_us)
+        stats->max_us = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+    if (overrun)
+        stats->overruns++;
+}
+
+/* Runs the most urgent due task, false if nothing was due */
+static bool scheduler_run()
+{
+    const unsigned long now = millis();
+    task_t *next = nullptr;
+
+    for (uint8_t i = 0; i < scheduler.count; i++)
+    {
+        task_t *task = scheduler.tasks[i];
+
+        if (task_due(task, now) && (next == nullptr || task->priority < next->priority))
+            next = task;
+    }
+
+    if (next == nullptr)
+        return false;
+
+    scheduler_exec(next, now);
+
+    return true;
+}
+
+/*
+* Milliseconds until the next task is due, SCHEDULER_IDLE if none is armed.
+* Clamped to SCHEDULER_IDLE, a task 65.5 s or more away reads as idle too.
+*/
+static uint16_t scheduler_next_wake()
+{
+    const unsigned long now = millis();
+    // the clamp, only shorter delays replace it
+    unsigned long wake = SCHEDULER_IDLE;
+
+    for (uint8_t i = 0; i < scheduler.count; i++)
+    {
+        const task_t *task = scheduler.tasks[i];
+
+        if (!(task->flags & TASK_ARMED))
+            continue;
+        if ((long)(now - task->due) >= 0)
+            return 0;
+        if (task->due - now < wake)
+            wake = task->due - now;
+    }
+
+    return wake;
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_SCHEDULER_H
@@ -0,0 +1,225 @@
+#ifndef IV6CLOCK_MOTHERBOARD_SETTINGS_H
+#define IV6CLOCK_MOTHERBOARD_SETTINGS_H
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "eeprom_writer.h"
+#include "ldr.h"
+#include "scheduler.h"
+
+/*
+* Persistent settings.
+*
+* `settings` is the live copy, the firmware reads and changes it directly
+* and calls settings_save() afterwards. The save is deferred by
+* SETTINGS_SAVE_DELAY_MS and every further save restarts the delay, so a
+* burst of changes costs one record. The record is then written in the
+* background by the eeprom_writer.
+*
+* Layout
+*
+* SETTINGS_SLOTS slots of SETTINGS_SLOT_SIZE bytes from SETTINGS_BASE form
+* a ring, every record goes to the slot after the newest one, so the
+* wear is spread over all of them and the previous record survives a
+* write cut short by a power loss. A record is
+*
+*   sequence    8 bit counter, the newest record is the highest one
+*   version     SETTINGS_VERSION of its layout
+*   size        bytes of settings_t that follow
+*   settings    settings_t, `size` bytes
+*   crc         CRC-8 of all of the above
+*
+* settings_t only ever grows at its end: a record of an older firmware is
+* shorter and the fields it lacks keep their defaults, so new settings
+* need neither new addresses nor a new version. SETTINGS_VERSION changes
+* only when the meaning of a stored field changes, records of another
+* version are skipped.
+*
+* Without any valid record the values are taken over from the fixed
+* addresses used before the ring, which are left in place: hue 0 and
+* brightness 1 of the first firmware, and the temperature offset at 2
+* that came with the fixed-point DHT12 readings. An erased offset cell
+* keeps the default.
+*/
+
+#define SETTINGS_VERSION 1
+
+#define SETTINGS_BASE 0x20
+#define SETTINGS_SLOT_SIZE 32
+#define SETTINGS_SLOTS 7
+#define SETTINGS_END (SETTINGS_BASE + SETTINGS_SLOTS * SETTINGS_SLOT_SIZE)
+
+#define SETTINGS_SAVE_DELAY_MS 2000
+// checks again while the writer is busy
+#define SETTINGS_RETRY_MS 50
+
+#define SETTINGS_HEADER_SIZE 3
+#define SETTINGS_NONE 0xFF
+
+#define SETTINGS_LEGACY_HUE 0
+#define SETTINGS_LEGACY_BRIGHTNESS 1
+#define SETTINGS_LEGACY_TEMP_OFFSET 2
+// an erased cell reads 0xFF, so the legacy offset could not store -0.1 C
+#define SETTINGS_LEGACY_UNSET 0xFF
+
+#define SETTINGS_TEMP_OFFSET_DEFAULT -40
+
+// append only, see above
+struct settings_t
+{
+    uint8_t hue;
+    uint8_t brightness;
+    // sensor self-heating correction, 0.1 C
+    int8_t temp_offset;
+    // ambient light to LED and VFD brightness
+    ldr_point_t ldr_curve[LDR_CURVE_POINTS];
+    // backlight effect (BACKLIGHT_*) and its span, see backlight.h
+    uint8_t effect;
+    uint8_t effect_span;
+};
+
+static_assert(SETTINGS_HEADER_SIZE + sizeof(settings_t) + 1 <= SETTINGS_SLOT_SIZE, "settings outgrew the slot");
+static_assert(SETTINGS_END <= 0x100, "settings ring overlaps the EEPROM above it");
+
+const settings_t settings_defaults PROGMEM = {
+    /*hue=*/0,
+    /*brightness=*/255,
+    /*temp_offset=*/SETTINGS_TEMP_OFFSET_DEFAULT,
+    /*ldr_curve=*/{
+        {/*light=*/0, /*led=*/60, /*vfd=*/96},
+        {/*light=*/120, /*led=*/100, /*vfd=*/128},
+        {/*light=*/200, /*led=*/255, /*vfd=*/255},
+        {/*light=*/255, /*led=*/255, /*vfd=*/255},
+    },
+    /*effect=*/0, // BACKLIGHT_SOLID
+    /*effect_span=*/32,
+};
+
+struct settings_store_t
+{
+    // newest valid record, slot SETTINGS_NONE before the first one
+    uint8_t slot;
+    uint8_t sequence;
+    // settings of that record, saves without a change are dropped
+    settings_t stored;
+
+    // record being written
+    uint8_t record[SETTINGS_SLOT_SIZE];
+
+    task_t *task;
+};
+
+settings_t settings;
+settings_store_t settings_store;
+
+static uint8_t settings_crc(const uint8_t *data, uint8_t length)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++)
+        crc = _crc8_ccitt_update(crc, data[i]);
+
+    return crc;
+}
+
+static inline uint16_t settings_slot_address(uint8_t slot)
+{
+    return SETTINGS_BASE + slot * SETTINGS_SLOT_SIZE;
+}
+
+/* Reads the record of `slot` into `record`, false if it is not valid */
+static bool settings_read_slot(uint8_t slot, uint8_t *record)
+{
+    const uint8_t *address = (const uint8_t *)(uintptr_t)settings_slot_address(slot);
+
+    eeprom_read_block(record, address, SETTINGS_HEADER_SIZE);
+    const uint8_t size = record[2];
+    if (record[1] != SETTINGS_VERSION || size > SETTINGS_SLOT_SIZE - SETTINGS_HEADER_SIZE - 1)
+        return false;
+
+    const uint8_t length = SETTINGS_HEADER_SIZE + size;
+    eeprom_read_block(record + SETTINGS_HEADER_SIZE, address + SETTINGS_HEADER_SIZE, size + 1);
+
+    return record[length] == settings_crc(record, length);
+}
+
+static void settings_load_legacy()
+{
+    settings.hue = eeprom_read_byte((uint8_t *)SETTINGS_LEGACY_HUE);
+    settings.brightness = eeprom_read_byte((uint8_t *)SETTINGS_LEGACY_BRIGHTNESS);
+
+    const uint8_t offset = eeprom_read_byte((uint8_t *)SETTINGS_LEGACY_TEMP_OFFSET);
+    if (offset != SETTINGS_LEGACY_UNSET)
+        settings.temp_offset = (int8_t)offset;
+}
+
+/* `task` is a registered one-shot task running settings_flush() */
+static void settings_init(task_t *task)
+{
+    settings_store.task = task;
+    settings_store.slot = SETTINGS_NONE;
+
+    memcpy_P(&settings, &settings_defaults, sizeof(settings));
+
+    uint8_t record[SETTINGS_SLOT_SIZE];
+    for (uint8_t slot = 0; slot < SETTINGS_SLOTS; slot++)
+    {
+        if (!settings_read_slot(slot, record))
+            continue;
+
+        // serial number arithmetic, the ring is far shorter than half the counter
+        if (settings_store.slot != SETTINGS_NONE && (int8_t)(record[0] - settings_store.sequence) <= 0)
+            continue;
+
+        settings_store.slot = slot;
+        settings_store.sequence = record[0];
+    }
+
+    if (settings_store.slot == SETTINGS_NONE)
+    {
+        settings_load_legacy();
+        scheduler_arm(task, 0);
+        return;
+    }
+
+    settings_read_slot(settings_store.slot, record);
+    const uint8_t size = record[2];
+    memcpy(&settings, record + SETTINGS_HEADER_SIZE, size < sizeof(settings) ? size : sizeof(settings));
+    settings_store.stored = settings;
+}
+
+/* Writes `settings` after SETTINGS_SAVE_DELAY_MS without a further save */
+static void settings_save()
+{
+    scheduler_arm(settings_store.task, SETTINGS_SAVE_DELAY_MS);
+}
+
+static void settings_flush()
+{
+    if (eeprom_writer_busy())
+    {
+        scheduler_arm(settings_store.task, SETTINGS_RETRY_MS);
+        return;
+    }
+
+    if (settings_store.slot != SETTINGS_NONE && memcmp(&settings, &settings_store.stored, sizeof(settings)) == 0)
+        return;
+
+    settings_store.stored = settings;
+    settings_store.slot = settings_store.slot == SETTINGS_NONE ? 0 : (settings_store.slot + 1) % SETTINGS_SLOTS;
+    settings_store.sequence++;
+
+    uint8_t *record = settings_store.record;
+    record[0] = settings_store.sequence;
+    record[1] = SETTINGS_VERSION;
+    record[2] = sizeof(settings);
+    memcpy(record + SETTINGS_HEADER_SIZE, &settings, sizeof(settings));
+
+    const uint8_t length = SETTINGS_HEADER_SIZE + sizeof(settings);
+    record[length] = settings_crc(record, length);
+
+    eeprom_writer_start(settings_slot_address(settings_store.slot), record, length + 1);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_SETTINGS_H
@@ -0,0 +1,150 @@
+#ifndef IV6CLOCK_MOTHERBOARD_SHIFT_REGISTER_H
+#define IV6CLOCK_MOTHERBOARD_SHIFT_REGISTER_H
+
+#include <Arduino.h>
+
+/*
+* 74HC595 x2 chain driving the IV6 segments and grids.
+*
+* The backend is selected at compile time with SR_BACKEND:
+*
+*   SR_BACKEND_SHIFTOUT - digitalWrite/shiftOut, the original path. Kept for
+*                         reference and for the scan benchmark.
+*   SR_BACKEND_PORT     - direct PORTD bit-banging on the existing wiring
+*                         (DS = PD5, SH_CP = PD6, ST_CP = PD7). Default.
+*   SR_BACKEND_USART    - USART0 in Master SPI mode at F_CPU / 2:
+*                         DS = TXD (PD1), SH_CP = XCK (PD4), ST_CP = PD7.
+*                         Requires a board rework: XCK is shared with the
+*                         encoder button and Serial can not be used.
+*
+* sr_write() shifts byte1 first, MSB first, and latches both registers.
+* Values are written as is, inversion is done by the caller.
+*/
+
+#define SR_BACKEND_SHIFTOUT 0
+#define SR_BACKEND_PORT 1
+#define SR_BACKEND_USART 2
+
+#ifndef SR_BACKEND
+#define SR_BACKEND SR_BACKEND_PORT
+#endif
+
+#define PIN_SR_DATA (uint8_t)5  //PD5  // DS
+#define PIN_SR_CLOCK (uint8_t)6 //PD6 // SH_CP
+#define PIN_SR_LATCH (uint8_t)7 //PD7 // ST_CP
+
+/***********************************
+* shiftOut backend
+***********************************/
+
+static inline void sr_init_shiftout()
+{
+    pinMode(PIN_SR_DATA, OUTPUT);
+    pinMode(PIN_SR_LATCH, OUTPUT);
+    pinMode(PIN_SR_CLOCK, OUTPUT);
+}
+
+static inline void sr_write_shiftout(uint8_t byte1, uint8_t byte2)
+{
+    digitalWrite(PIN_SR_LATCH, LOW);
+    shiftOut(PIN_SR_DATA, PIN_SR_CLOCK, MSBFIRST, byte1);
+    shiftOut(PIN_SR_DATA, PIN_SR_CLOCK, MSBFIRST, byte2);
+    digitalWrite(PIN_SR_LATCH, HIGH);
+}
+
+/***********************************
+* PORTD backend
+***********************************/
+
+static inline void sr_init_port()
+{
+    DDRD |= _BV(PD5) | _BV(PD6) | _BV(PD7);
+    PORTD &= ~(_BV(PD5) | _BV(PD6));
+}
+
+// sbi/cbi only, so PORTD writes from other contexts are never lost
+#define SR_PORT_BIT(value, bit)       \
+    if ((value) & (1u << (bit)))      \
+        PORTD |= _BV(PD5);            \
+    else                              \
+        PORTD &= ~_BV(PD5);           \
+    PORTD |= _BV(PD6);                \
+    PORTD &= ~_BV(PD6);
+
+static inline void sr_port_byte(uint8_t value)
+{
+    SR_PORT_BIT(value, 7)
+    SR_PORT_BIT(value, 6)
+    SR_PORT_BIT(value, 5)
+    SR_PORT_BIT(value, 4)
+    SR_PORT_BIT(value, 3)
+    SR_PORT_BIT(value, 2)
+    SR_PORT_BIT(value, 1)
+    SR_PORT_BIT(value, 0)
+}
+
+static inline void sr_write_port(uint8_t byte1, uint8_t byte2)
+{
+    PORTD &= ~_BV(PD7);
+    sr_port_byte(byte1);
+    sr_port_byte(byte2);
+    PORTD |= _BV(PD7);
+}
+
+/***********************************
+* USART0 Master SPI backend
+***********************************/
+
+static inline void sr_init_usart()
+{
+    UBRR0 = 0;
+    DDRD |= _BV(PD1) | _BV(PD4) | _BV(PD7);
+    // MSPIM, SPI mode 0, MSB first
+    UCSR0C = _BV(UMSEL01) | _BV(UMSEL00);
+    UCSR0B = _BV(TXEN0);
+    // baud rate must be set after the transmitter is enabled
+    UBRR0 = 0;
+}
+
+static inline void sr_write_usart(uint8_t byte1, uint8_t byte2)
+{
+    PORTD &= ~_BV(PD7);
+    UCSR0A = _BV(TXC0);
+    UDR0 = byte1;
+    while (!(UCSR0A & _BV(UDRE0)))
+        ;
+    UDR0 = byte2;
+    while (!(UCSR0A & _BV(TXC0)))
+        ;
+    PORTD |= _BV(PD7);
+}
+
+/***********************************
+* Selected backend
+***********************************/
+
+static inline void sr_init()
+{
+#if SR_BACKEND == SR_BACKEND_SHIFTOUT
+    sr_init_shiftout();
+#elif SR_BACKEND == SR_BACKEND_PORT
+    sr_init_port();
+#elif SR_BACKEND == SR_BACKEND_USART
+    sr_init_usart();
+#else
+#error "Unknown SR_BACKEND"
+#endif
+}
+
+static inline void sr_write(uint8_t byte1, uint8_t byte2)
+{
+#if SR_BACKEND == SR_BACKEND_SHIFTOUT
+    sr_write_shiftout(byte1, byte2);
+#elif SR_BACKEND == SR_BACKEND_PORT
+    sr_write_port(byte1, byte2);
+#elif SR_BACKEND == SR_BACKEND_USART
+    sr_write_usart(byte1, byte2);
+#endif
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_SHIFT_REGISTER_H
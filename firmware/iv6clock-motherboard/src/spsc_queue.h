@@ -0,0 +1,69 @@
+#ifndef IV6CLOCK_MOTHERBOARD_SPSC_QUEUE_H
+#define IV6CLOCK_MOTHERBOARD_SPSC_QUEUE_H
+
+#include <stdint.h>
+
+/*
+* Lock-free single producer, single consumer ring buffer.
+*
+* One side pushes (usually an ISR), the other pops (the main loop), and
+* neither disables interrupts. Each index is a single byte written by one
+* side only, so every access to it is atomic on the AVR. The indices run
+* freely and wrap at 256, N must be a power of two so the slot is just
+* the masked index. A full queue refuses the push.
+*/
+
+// keeps the compiler from moving memory accesses across it
+#define SPSC_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+template <typename T, uint8_t N>
+struct spsc_queue_t
+{
+    static_assert(N != 0 && (N & (N - 1)) == 0, "queue size must be a power of two");
+
+    T items[N];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+
+    /* Producer side */
+    bool push(const T &item)
+    {
+        const uint8_t at = this->head;
+        if ((uint8_t)(at - this->tail) >= N)
+            return false;
+
+        this->items[at & (N - 1)] = item;
+        SPSC_BARRIER();
+        this->head = at + 1;
+
+        return true;
+    }
+
+    /* Consumer side */
+    bool pop(T *item)
+    {
+        const uint8_t at = this->tail;
+        if (at == this->head)
+            return false;
+
+        SPSC_BARRIER();
+        *item = this->items[at & (N - 1)];
+        SPSC_BARRIER();
+        this->tail = at + 1;
+
+        return true;
+    }
+
+    bool empty() const
+    {
+        return this->tail == this->head;
+    }
+
+    /* Free slots, exact on the producer side, the consumer only adds to them */
+    uint8_t space() const
+    {
+        return N - (uint8_t)(this->head - this->tail);
+    }
+};
+
+#endif //IV6CLOCK_MOTHERBOARD_SPSC_QUEUE_H
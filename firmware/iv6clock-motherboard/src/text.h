@@ -0,0 +1,302 @@
+#ifndef IV6CLOCK_MOTHERBOARD_TEXT_H
+#define IV6CLOCK_MOTHERBOARD_TEXT_H
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include <stdarg.h>
+
+#include "display.h"
+#include "scheduler.h"
+
+/*
+* Text layer over the symbol frame.
+*
+* Every writer fills a symbol buffer, usually display.symbols or a
+* keyframe, and never commits. Characters are mapped to the closest glyph
+* the tubes can show, a '.' lights the decimal point of the symbol
+* before it.
+*
+*   text_print        integer right aligned in `width` tubes
+*   text_printf       printf-lite, the format is a flash string (PSTR):
+*                     %d %u %x %c %s, an optional '0' flag and width,
+*                     %W.Nd prints an integer scaled by 10^N as fixed point
+*
+* The marquee scrolls text longer than the display in from the right and
+* out to the left, one tube per step. Its steps are a one-shot scheduler
+* task that re-arms itself, nothing polls while it is stopped. While
+* text_marquee_busy() the marquee owns the display.
+*/
+
+#define TEXT_MARQUEE_SIZE 32
+#define TEXT_MARQUEE_STEP_MS 250
+
+enum
+{
+    TEXT_ZERO_PAD = 1 << 0,
+    TEXT_HEX = 1 << 1,
+};
+
+// glyph of 'A'..'Z', letters a tube can not show borrow the closest one
+const uint8_t text_letters[26] PROGMEM = {
+    SYMBOL_A, SYMBOL_B, SYMBOL_C, SYMBOL_D, SYMBOL_E, SYMBOL_F, SYMBOL_G, SYMBOL_H, SYMBOL_I,
+    SYMBOL_J, SYMBOL_H, SYMBOL_L, SYMBOL_N, SYMBOL_N, 0, SYMBOL_P, SYMBOL_Q, SYMBOL_R,
+    SYMBOL_S, SYMBOL_T, SYMBOL_U, SYMBOL_U, SYMBOL_U, SYMBOL_H, SYMBOL_Y, 2,
+};
+
+struct text_out_t
+{
+    uint8_t *symbols;
+    uint8_t size;
+    uint8_t count;
+};
+
+struct text_marquee_t
+{
+    uint8_t symbols[TEXT_MARQUEE_SIZE];
+    uint8_t length;
+    // steps taken in the current pass, 0 is a blank display
+    uint8_t offset;
+    uint8_t loops;
+    uint16_t step_ms;
+
+    task_t *task;
+};
+
+text_marquee_t text_marquee;
+
+static uint8_t text_symbol(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+
+    switch (c)
+    {
+    case 'c':
+        return SYMBOL_C_SMALL;
+    case 'h':
+        return SYMBOL_H_SMALL;
+    case 'o':
+        return SYMBOL_O;
+    case 'u':
+        return SYMBOL_U_SMALL;
+    case '-':
+        return SYMBOL_MINUS;
+    case '_':
+        return SYMBOL_UNDERSCORE;
+    case '*':
+        return SYMBOL_DEGREE;
+    }
+
+    if (c >= 'a' && c <= 'z')
+        c -= 'a' - 'A';
+    if (c >= 'A' && c <= 'Z')
+        return pgm_read_byte(&text_letters[c - 'A']);
+
+    return SYMBOL_EMPTY;
+}
+
+static void text_put(text_out_t *out, uint8_t symbol)
+{
+    if (out->count < out->size)
+        out->symbols[out->count++] = symbol;
+}
+
+/* Lights the point of the last symbol, a leading point gets a blank of its own */
+static void text_dot(text_out_t *out)
+{
+    if (out->count > 0 && !(out->symbols[out->count - 1] & SYMBOL_DP))
+        out->symbols[out->count - 1] |= SYMBOL_DP;
+    else
+        text_put(out, SYMBOL_EMPTY | SYMBOL_DP);
+}
+
+static void text_put_number(text_out_t *out, long value, uint8_t width, uint8_t decimals, uint8_t flags)
+{
+    const uint8_t base = flags & TEXT_HEX ? 16 : 10;
+    const bool negative = value < 0;
+    unsigned long magnitude = negative ? -(unsigned long)value : value;
+
+    // least significant first, at least one digit before the point
+    uint8_t digits[11];
+    uint8_t n = 0;
+    do
+    {
+        digits[n++] = magnitude % base;
+        magnitude /= base;
+    } while ((magnitude != 0 || n <= decimals) && n < sizeof(digits));
+
+    const uint8_t length = n + negative;
+    uint8_t pad = width > length ? width - length : 0;
+
+    if (!(flags & TEXT_ZERO_PAD))
+    {
+        for (; pad > 0; pad--)
+            text_put(out, SYMBOL_EMPTY);
+    }
+    if (negative)
+        text_put(out, SYMBOL_MINUS);
+    for (; pad > 0; pad--)
+        text_put(out, 0);
+
+    while (n > 0)
+    {
+        n--;
+        text_put(out, digits[n]);
+        if (decimals != 0 && n == decimals)
+            text_dot(out);
+    }
+}
+
+/* Writes `value` right aligned into symbols[pos] .. symbols[pos + width - 1] */
+static void text_print(uint8_t *symbols, uint8_t pos, uint8_t width, int value, uint8_t flags = 0)
+{
+    text_out_t out = {symbols + pos, width, 0};
+    text_put_number(&out, value, width, 0, flags);
+}
+
+static uint8_t text_vprintf(uint8_t *symbols, uint8_t size, PGM_P format, va_list args)
+{
+    text_out_t out = {symbols, size, 0};
+
+    for (;;)
+    {
+        char c = pgm_read_byte(format++);
+        if (c == '\0')
+            break;
+
+        if (c == '.')
+        {
+            text_dot(&out);
+            continue;
+        }
+        if (c != '%')
+        {
+            text_put(&out, text_symbol(c));
+            continue;
+        }
+
+        uint8_t flags = 0;
+        uint8_t width = 0;
+        uint8_t decimals = 0;
+
+        c = pgm_read_byte(format++);
+        if (c == '0')
+        {
+            flags |= TEXT_ZERO_PAD;
+            c = pgm_read_byte(format++);
+        }
+        for (; c >= '0' && c <= '9'; c = pgm_read_byte(format++))
+            width = width * 10 + c - '0';
+        if (c == '.')
+        {
+            for (c = pgm_read_byte(format++); c >= '0' && c <= '9'; c = pgm_read_byte(format++))
+                decimals = decimals * 10 + c - '0';
+        }
+
+        switch (c)
+        {
+        case 'd':
+            text_put_number(&out, va_arg(args, int), width, decimals, flags);
+            break;
+        case 'u':
+            text_put_number(&out, va_arg(args, unsigned), width, decimals, flags);
+            break;
+        case 'x':
+            text_put_number(&out, va_arg(args, unsigned), width, 0, flags | TEXT_HEX);
+            break;
+        case 'c':
+            text_put(&out, text_symbol((char)va_arg(args, int)));
+            break;
+        case 's':
+            for (const char *s = va_arg(args, const char *); *s != '\0'; s++)
+            {
+                if (*s == '.')
+                    text_dot(&out);
+                else
+                    text_put(&out, text_symbol(*s));
+            }
+            break;
+        default:
+            // unknown conversion or the end of the format
+            format--;
+        }
+    }
+
+    const uint8_t count = out.count;
+    while (out.count < out.size)
+        text_put(&out, SYMBOL_EMPTY);
+
+    return count;
+}
+
+/* Formats into `symbols`, blanks the rest of `size`, returns the symbols written */
+static uint8_t text_printf(uint8_t *symbols, uint8_t size, PGM_P format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    const uint8_t count = text_vprintf(symbols, size, format, args);
+    va_end(args);
+
+    return count;
+}
+
+/***********************************
+* Marquee
+***********************************/
+
+/* `task` is a registered one-shot task running text_marquee_step() */
+static void text_marquee_init(task_t *task)
+{
+    text_marquee.task = task;
+}
+
+static inline bool text_marquee_busy()
+{
+    return text_marquee.task->flags & TASK_ARMED;
+}
+
+static void text_marquee_stop()
+{
+    scheduler_disarm(text_marquee.task);
+}
+
+/* Scrolls the formatted text through `loops` passes, 0 repeats until stopped */
+static void text_marquee_printf(uint16_t step_ms, uint8_t loops, PGM_P format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    text_marquee.length = text_vprintf(text_marquee.symbols, TEXT_MARQUEE_SIZE, format, args);
+    va_end(args);
+
+    text_marquee.offset = 0;
+    text_marquee.loops = loops;
+    text_marquee.step_ms = step_ms;
+
+    scheduler_arm(text_marquee.task, 0);
+}
+
+static void text_marquee_step()
+{
+    // [blank display][text] moving left until the text left the display
+    for (uint8_t i = 0; i < DISPLAY_DIGITS; i++)
+    {
+        const int16_t n = text_marquee.offset + i - DISPLAY_DIGITS;
+        display_set(i, n >= 0 && n < text_marquee.length ? text_marquee.symbols[n] : SYMBOL_EMPTY);
+    }
+    display_commit();
+
+    if (text_marquee.offset < text_marquee.length + DISPLAY_DIGITS)
+    {
+        text_marquee.offset++;
+    }
+    else
+    {
+        text_marquee.offset = 1;
+        if (text_marquee.loops != 0 && --text_marquee.loops == 0)
+            return;
+    }
+
+    scheduler_arm(text_marquee.task, text_marquee.step_ms);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_TEXT_H
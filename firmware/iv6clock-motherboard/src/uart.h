@@ -0,0 +1,101 @@
+#ifndef IV6CLOCK_MOTHERBOARD_UART_H
+#define IV6CLOCK_MOTHERBOARD_UART_H
+
+#include <Arduino.h>
+
+#include "spsc_queue.h"
+
+/*
+* Interrupt driven serial port on USART0, 8N1 at UART_BAUD.
+*
+* uart_rx_ready() runs from USART_RX_vect and pushes every received byte
+* into `uart.rx`, uart_tx_ready() runs from USART_UDRE_vect and feeds the
+* transmitter from `uart.tx`. The main loop is the other side of both
+* queues and never waits on the line. The Data Register Empty interrupt
+* is only enabled while the TX queue holds something.
+*
+* A byte that finds the RX queue full is dropped and counted, so are
+* bytes the USART broke or lost itself (frame error, data overrun).
+* uart_write() drops what does not fit, check uart_tx_space() first to
+* keep a block of bytes together.
+*/
+
+#define UART_BAUD 38400
+// double speed, 0.2 % off at 16 MHz
+#define UART_UBRR (F_CPU / 8 / UART_BAUD - 1)
+
+#define UART_RX_SIZE 64
+// holds the longest frame, log frames that find no room are dropped
+#define UART_TX_SIZE 64
+
+struct uart_t
+{
+    spsc_queue_t<uint8_t, UART_RX_SIZE> rx;
+    spsc_queue_t<uint8_t, UART_TX_SIZE> tx;
+
+    // saturate, written by USART_RX_vect only
+    volatile uint8_t rx_overflows;
+    volatile uint8_t rx_errors;
+};
+
+uart_t uart;
+
+static void uart_init()
+{
+    UBRR0 = UART_UBRR;
+    UCSR0A = _BV(U2X0);
+    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+}
+
+/* Called from USART_RX_vect */
+static inline void uart_rx_ready()
+{
+    // the status belongs to the byte in UDR0, it must be read first
+    const uint8_t status = UCSR0A;
+    const uint8_t value = UDR0;
+
+    if (status & (_BV(FE0) | _BV(DOR0)))
+    {
+        if (uart.rx_errors != 0xFF)
+            uart.rx_errors++;
+
+        // an overrun lost the bytes before this one, a frame error this one
+        if (status & _BV(FE0))
+            return;
+    }
+
+    if (!uart.rx.push(value) && uart.rx_overflows != 0xFF)
+        uart.rx_overflows++;
+}
+
+/* Called from USART_UDRE_vect */
+static inline void uart_tx_ready()
+{
+    uint8_t value;
+    if (uart.tx.pop(&value))
+        UDR0 = value;
+    else
+        UCSR0B &= ~_BV(UDRIE0);
+}
+
+static inline bool uart_read(uint8_t *value)
+{
+    return uart.rx.pop(value);
+}
+
+static inline uint8_t uart_tx_space()
+{
+    return uart.tx.space();
+}
+
+static void uart_write(uint8_t value)
+{
+    if (!uart.tx.push(value))
+        return;
+
+    // after the push, the interrupt may have just run dry and turned itself off
+    UCSR0B |= _BV(UDRIE0);
+}
+
+#endif //IV6CLOCK_MOTHERBOARD_UART_H
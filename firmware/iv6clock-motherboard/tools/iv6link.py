@@ -0,0 +1,444 @@
+#!/usr/bin/env python3
+"""Configure and monitor a clock over its serial protocol.
+
+Talks to src/protocol.h at 38400 baud 8N1, either on a serial port (needs
+pyserial) or to the native build started with --link:
+
+    tools/iv6link.py --port /dev/ttyUSB0 sensors
+    tools/iv6link.py --sim .pio/build/native/program sensors
+
+Commands:
+
+    ping                        protocol version and uptime
+    time [HH:MM[:SS] | now]     read or set the RTC
+    sensors                     temperature, humidity, light and brightness
+    settings [FIELD=VALUE ...]  print the settings, or change and store them
+    tasks                       scheduler statistics per task
+    counters                    duty cycle and dropped bytes
+    scan [--reset] [--dump]     scan ISR timing, SCAN_STATS builds only
+    history                     24 hour extremes and trend
+    log [--seconds N] [SOURCE]  stream log entries (sensors, ambient)
+
+`settings` prints FIELD=VALUE lines that can be passed back to `settings`,
+so one clock's configuration is copied to another with
+
+    tools/iv6link.py --port A settings > clock.conf
+    tools/iv6link.py --port B settings $(cat clock.conf)
+
+The scan summary has the line format of tools/scan_vcd.py.
+"""
+
+import argparse
+import os
+import select
+import struct
+import subprocess
+import sys
+import time
+
+BAUD = 38400
+SYNC = 0xA5
+PAYLOAD_MAX = 40
+REPLY = 0x80
+
+PING = 0x01
+LOG_MASK = 0x02
+GET_TIME = 0x03
+SET_TIME = 0x04
+SENSORS = 0x05
+GET_SETTINGS = 0x06
+SET_SETTINGS = 0x07
+TASK = 0x08
+COUNTERS = 0x09
+SCAN = 0x0A
+SCAN_SAMPLES = 0x0B
+HISTORY = 0x0C
+LOG = 0x7E
+ERROR = 0x7F
+
+ERRORS = {1: "unknown command", 2: "bad length", 3: "bad argument", 4: "busy", 5: "not in this build"}
+
+LOG_SOURCES = ["sensors", "ambient"]
+
+# TASK_PRIORITY_* of main.cpp
+PRIORITIES = ["input", "twi", "rtc", "animation", "render", "leds", "sensors", "storage", "protocol"]
+TASK_ONESHOT = 1 << 0
+
+# HISTORY_TREND_* and the out of range ends of history.h, 0.1 C
+HISTORY_TREND_TEMPERATURE = 1 << 0
+HISTORY_TREND_HUMIDITY = 1 << 1
+HISTORY_BELOW = -100
+HISTORY_ABOVE = 410
+
+SCAN_NOMINAL = 125 * 256
+SCAN_RING = 32
+SCAN_RESET = 0x01
+SCAN_FREEZE = 0x02
+
+LDR_CURVE_POINTS = 4
+
+
+class LinkError(Exception):
+    pass
+
+
+def crc8(data, crc=0):
+    """_crc8_ccitt_update() of avr-libc."""
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def frame(command, payload=b""):
+    body = bytes([len(payload), command]) + payload
+    return bytes([SYNC]) + body + bytes([crc8(body)])
+
+
+class SerialPort:
+    def __init__(self, path, baud):
+        try:
+            import serial
+        except ImportError:
+            sys.exit("--port needs pyserial (pip install pyserial)")
+        self.port = serial.Serial(path, baud, timeout=0)
+
+    def write(self, data):
+        self.port.write(data)
+
+    def read(self, timeout):
+        select.select([self.port], [], [], timeout)
+        return self.port.read(256)
+
+    def close(self):
+        self.port.close()
+
+
+class SimPort:
+    """The native build with --link, the serial port on its stdin and stdout."""
+
+    def __init__(self, program, args):
+        self.process = subprocess.Popen([program, "--link"] + args, stdin=subprocess.PIPE,
+                                        stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+
+    def write(self, data):
+        self.process.stdin.write(data)
+        self.process.stdin.flush()
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.process.stdout], [], [], timeout)
+        if not ready:
+            return b""
+        data = os.read(self.process.stdout.fileno(), 256)
+        if not data:
+            raise LinkError("the simulator exited")
+        return data
+
+    def close(self):
+        self.process.stdin.close()
+        self.process.wait()
+
+
+class Link:
+    def __init__(self, port, timeout=0.5, retries=3, on_log=None):
+        self.port = port
+        self.timeout = timeout
+        self.retries = retries
+        self.on_log = on_log
+        self.buffer = bytearray()
+
+    def receive(self, deadline):
+        """Next valid frame as (command, payload), None once `deadline` passed."""
+        while True:
+            # hunt for a sync byte, then wait for the whole frame
+            while self.buffer and self.buffer[0] != SYNC:
+                del self.buffer[0]
+            if len(self.buffer) >= 2 and self.buffer[1] > PAYLOAD_MAX:
+                del self.buffer[0]
+                continue
+            if len(self.buffer) >= 2 and len(self.buffer) >= self.buffer[1] + 4:
+                length = self.buffer[1]
+                body = bytes(self.buffer[1:length + 3])
+                if crc8(body) == self.buffer[length + 3]:
+                    del self.buffer[:length + 4]
+                    return body[1], body[2:]
+                del self.buffer[0]
+                continue
+
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            self.buffer += self.port.read(remaining)
+
+    def command(self, command, payload=b""):
+        for _ in range(self.retries):
+            self.port.write(frame(command, payload))
+            deadline = time.monotonic() + self.timeout
+
+            while True:
+                received = self.receive(deadline)
+                if received is None:
+                    break
+                reply, data = received
+                if reply == LOG:
+                    if self.on_log:
+                        self.on_log(data)
+                elif reply == command | REPLY:
+                    return data
+                elif reply == ERROR and data[0] == command:
+                    raise LinkError("%s: %s" % (COMMAND_NAMES.get(command, command), ERRORS.get(data[1], data[1])))
+
+        raise LinkError("no answer to %s" % COMMAND_NAMES.get(command, command))
+
+    def listen(self, seconds):
+        end = time.monotonic() + seconds
+        while time.monotonic() < end:
+            received = self.receive(min(end, time.monotonic() + 0.5))
+            if received is not None and received[0] == LOG and self.on_log:
+                self.on_log(received[1])
+
+
+COMMAND_NAMES = {PING: "ping", LOG_MASK: "log", GET_TIME: "time", SET_TIME: "time", SENSORS: "sensors",
+                 GET_SETTINGS: "settings", SET_SETTINGS: "settings", TASK: "tasks", COUNTERS: "counters",
+                 SCAN: "scan", SCAN_SAMPLES: "scan", HISTORY: "history"}
+
+
+# settings_t, append only: (name, struct format)
+SETTINGS_FIELDS = [
+    ("hue", "B"),
+    ("brightness", "B"),
+    ("temp_offset", "b"),
+    ("ldr_curve", "%dB" % (LDR_CURVE_POINTS * 3)),
+    # 0 solid, 1 gradient, 2 breathe
+    ("effect", "B"),
+    ("effect_span", "B"),
+]
+
+
+def settings_decode(data):
+    """Known fields of a settings_t, fields past `data` are left out."""
+    values = {}
+    offset = 0
+    for name, fmt in SETTINGS_FIELDS:
+        size = struct.calcsize(fmt)
+        if offset + size > len(data):
+            break
+        fields = struct.unpack_from("<" + fmt, data, offset)
+        if name == "ldr_curve":
+            values[name] = ",".join("%d/%d/%d" % fields[i:i + 3] for i in range(0, len(fields), 3))
+        else:
+            values[name] = fields[0]
+        offset += size
+    return values
+
+
+def settings_encode(data, changes):
+    data = bytearray(data)
+    offset = 0
+    for name, fmt in SETTINGS_FIELDS:
+        size = struct.calcsize(fmt)
+        if name in changes:
+            if offset + size > len(data):
+                raise LinkError("the clock has no setting %s" % name)
+            value = changes.pop(name)
+            if name == "ldr_curve":
+                points = [int(v) for point in value.split(",") for v in point.split("/")]
+                if len(points) != LDR_CURVE_POINTS * 3:
+                    raise LinkError("ldr_curve needs %d LIGHT/LED/VFD points" % LDR_CURVE_POINTS)
+                struct.pack_into("<" + fmt, data, offset, *points)
+            else:
+                struct.pack_into("<" + fmt, data, offset, int(value, 0))
+        offset += size
+    if changes:
+        raise LinkError("unknown setting %s" % ", ".join(changes))
+    return bytes(data)
+
+
+def print_log(data):
+    source = data[0]
+    stamp = time.strftime("%H:%M:%S")
+    if source == 0:
+        status, temperature, humidity = struct.unpack("<bhh", data[1:6])
+        print("%s sensors status=%d temperature=%.1f humidity=%.1f" % (stamp, status, temperature / 10.0,
+                                                                       humidity / 10.0))
+    elif source == 1:
+        light, led, vfd = data[1:4]
+        print("%s ambient light=%d led=%d vfd=%d" % (stamp, light, led, vfd))
+    else:
+        print("%s source %d: %s" % (stamp, source, data[1:].hex()))
+    sys.stdout.flush()
+
+
+def do_ping(link, args):
+    version, payload_max, uptime = struct.unpack("<BBI", link.command(PING))
+    print("protocol %d, payload %d bytes, up %.3f s" % (version, payload_max, uptime / 1000.0))
+
+
+def do_time(link, args):
+    if args.value:
+        if args.value == "now":
+            now = time.localtime()
+            hour, minute, second = now.tm_hour, now.tm_min, now.tm_sec
+        else:
+            parts = [int(part) for part in args.value.split(":")] + [0]
+            hour, minute, second = parts[:3]
+        link.command(SET_TIME, bytes([hour, minute, second]))
+    print("%02d:%02d:%02d" % tuple(link.command(GET_TIME)))
+
+
+def do_sensors(link, args):
+    status, temperature, humidity, ldr_ready, light, led, vfd = struct.unpack("<bhhBBBB", link.command(SENSORS))
+    if status == 0:
+        print("temperature %.1f C, humidity %.1f %%" % (temperature / 10.0, humidity / 10.0))
+    else:
+        print("temperature and humidity unavailable, status %d" % status)
+    print("light %s, led %d, vfd %d/15" % (light if ldr_ready else "-", led, vfd))
+
+
+def do_settings(link, args):
+    data = link.command(GET_SETTINGS)
+    version, size = data[0], data[1]
+    record = data[2:2 + size]
+
+    if args.changes:
+        changes = dict(change.split("=", 1) for change in args.changes)
+        record = settings_encode(record, changes)
+        link.command(SET_SETTINGS, bytes([version, len(record)]) + record)
+        record = link.command(GET_SETTINGS)[2:]
+
+    for name, value in settings_decode(record).items():
+        print("%s=%s" % (name, value))
+
+
+def do_tasks(link, args):
+    print("  # priority   period      runs    avg us  max us  overruns")
+    index = 0
+    count = 1
+    while index < count:
+        fields = struct.unpack("<BBBHIIHH", link.command(TASK, bytes([index])))
+        count, priority, flags, period, runs, total_us, max_us, overruns = fields
+        name = PRIORITIES[priority] if priority < len(PRIORITIES) else str(priority)
+        period = "once" if flags & TASK_ONESHOT else "%d ms" % period
+        print("%3d %-10s %7s %9d %9.1f %7d %9d" % (index, name, period, runs, total_us / runs if runs else 0.0,
+                                                     max_us, overruns))
+        index += 1
+
+
+def do_counters(link, args):
+    fields = struct.unpack("<IHBBBHHH", link.command(COUNTERS))
+    uptime, duty, input_overflows, rx_overflows, rx_errors, crc_errors, timeouts, log_drops = fields
+    print("uptime %.3f s" % (uptime / 1000.0))
+    print("duty cycle %.1f %%" % (duty / 10.0))
+    print("input events lost %d" % input_overflows)
+    print("serial rx overflows %d, errors %d" % (rx_overflows, rx_errors))
+    print("frames with bad crc %d, timed out %d" % (crc_errors, timeouts))
+    print("log entries dropped %d" % log_drops)
+
+
+def do_scan(link, args):
+    flags = (SCAN_RESET if args.reset else 0) | (SCAN_FREEZE if args.dump else 0)
+    data = link.command(SCAN, bytes([flags]))
+    count, deviation, period_min, period_max, duration_sum, duration_max = struct.unpack("<IiHHIH", data)
+
+    if count == 0:
+        print("scan n=0")
+    else:
+        # C division, truncated towards zero
+        average = SCAN_NOMINAL + int(deviation / count)
+        print("scan n=%d period min=%d avg=%d max=%d isr avg=%d max=%d" % (
+            count, period_min, average, period_max, duration_sum // count, duration_max))
+
+    if not args.dump:
+        return
+    offset = 0
+    while offset < SCAN_RING:
+        page = link.command(SCAN_SAMPLES, bytes([offset]))
+        for i in range(1, len(page), 4):
+            print("%d %d" % struct.unpack_from("<HH", page, i))
+        offset += (len(page) - 1) // 4
+
+
+def history_temperature(value):
+    if value == HISTORY_BELOW:
+        return "below %.1f" % ((HISTORY_BELOW + 1) / 10.0)
+    if value == HISTORY_ABOVE:
+        return "above %.1f" % ((HISTORY_ABOVE - 1) / 10.0)
+    return "%.1f" % (value / 10.0)
+
+
+def do_history(link, args):
+    fields = struct.unpack("<HhhBBBhb", link.command(HISTORY))
+    samples, temperature_min, temperature_max, humidity_min, humidity_max, trend, temperature_trend, \
+        humidity_trend = fields
+    print("samples %d" % samples)
+    if samples:
+        print("temperature %s .. %s C" % (history_temperature(temperature_min), history_temperature(temperature_max)))
+        print("humidity %d .. %d %%" % (humidity_min, humidity_max))
+    if trend & HISTORY_TREND_TEMPERATURE:
+        print("trend %+.1f C" % (temperature_trend / 10.0))
+    if trend & HISTORY_TREND_HUMIDITY:
+        print("trend %+d %%" % humidity_trend)
+
+
+def do_log(link, args):
+    sources = args.sources or LOG_SOURCES
+    mask = 0
+    for source in sources:
+        if source not in LOG_SOURCES:
+            raise LinkError("unknown log source %s, one of %s" % (source, ", ".join(LOG_SOURCES)))
+        mask |= 1 << LOG_SOURCES.index(source)
+
+    link.command(LOG_MASK, bytes([mask]))
+    try:
+        link.listen(args.seconds if args.seconds is not None else float("inf"))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        link.command(LOG_MASK, bytes([0]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    transport = parser.add_mutually_exclusive_group(required=True)
+    transport.add_argument("--port", help="serial port of the clock")
+    transport.add_argument("--sim", help="native build to start with --link")
+    parser.add_argument("--sim-arg", action="append", default=[], help="extra simulator option, repeatable")
+    parser.add_argument("--baud", type=int, default=BAUD)
+    parser.add_argument("--timeout", type=float, default=0.5, help="seconds to wait for an answer")
+    parser.add_argument("--retries", type=int, default=3)
+
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("ping").set_defaults(run=do_ping)
+    command = commands.add_parser("time")
+    command.add_argument("value", nargs="?")
+    command.set_defaults(run=do_time)
+    commands.add_parser("sensors").set_defaults(run=do_sensors)
+    command = commands.add_parser("settings")
+    command.add_argument("changes", nargs="*", metavar="FIELD=VALUE")
+    command.set_defaults(run=do_settings)
+    commands.add_parser("tasks").set_defaults(run=do_tasks)
+    commands.add_parser("counters").set_defaults(run=do_counters)
+    command = commands.add_parser("scan")
+    command.add_argument("--reset", action="store_true", help="reset the statistics after reading them")
+    command.add_argument("--dump", action="store_true", help="also print the last period/duration pairs")
+    command.set_defaults(run=do_scan)
+    commands.add_parser("history").set_defaults(run=do_history)
+    command = commands.add_parser("log")
+    command.add_argument("--seconds", type=float)
+    command.add_argument("sources", nargs="*", metavar="SOURCE")
+    command.set_defaults(run=do_log)
+    args = parser.parse_args()
+
+    port = SerialPort(args.port, args.baud) if args.port else SimPort(args.sim, args.sim_arg)
+    link = Link(port, args.timeout, args.retries, on_log=print_log)
+    try:
+        args.run(link, args)
+    except LinkError as error:
+        sys.exit(str(error))
+    finally:
+        port.close()
+
+
+if __name__ == "__main__":
+    main()
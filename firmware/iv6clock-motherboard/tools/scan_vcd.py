@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Scan timing from a VCD trace of the SCAN_TRACE pin.
+
+Build with -D SCAN_TRACE (pio run -e scan_trace), the pin is high while
+the Timer2 scan ISR runs. Record it with simavr, PORTC is at data address
+0x28 and the trace pin is PC3:
+
+    simavr -m atmega328p -f 16000000 \\
+        --vcd-trace-file scan.vcd --add-vcd-trace scan=trace@0x28/0x08 \\
+        .pio/build/scan_trace/firmware.elf
+
+or with a logic analyser exporting VCD, then:
+
+    tools/scan_vcd.py scan.vcd [--signal scan] [--f-cpu 16000000] [--dump 32]
+
+The summary line has the format of `tools/iv6link.py scan` on a SCAN_STATS
+build, all figures in CPU cycles. The pin goes high a few cycles after the Timer1
+timestamp is taken, so durations read slightly lower.
+"""
+
+import argparse
+import sys
+
+NOMINAL = 125 * 256
+
+TIMESCALE_UNITS = {"s": 1.0, "ms": 1e-3, "us": 1e-6, "ns": 1e-9, "ps": 1e-12, "fs": 1e-15}
+
+
+def parse_timescale(text):
+    text = text.strip()
+    number = "".join(c for c in text if c.isdigit())
+    unit = text[len(number):].strip()
+    return int(number or 1) * TIMESCALE_UNITS[unit]
+
+
+def read_vcd(path, wanted):
+    """Returns (timescale in seconds, [(time, level)]) of the wanted signal."""
+    with open(path) as vcd:
+        tokens = iter(vcd.read().split())
+
+    def until_end():
+        return list(iter(lambda: next(tokens), "$end"))
+
+    timescale = 1e-9
+    signals = {}
+
+    # header
+    for token in tokens:
+        if token == "$timescale":
+            timescale = parse_timescale("".join(until_end()))
+        elif token == "$var":
+            _kind, _width, code, name = until_end()[:4]
+            signals[name] = code
+        elif token == "$enddefinitions":
+            until_end()
+            break
+
+    if wanted is None:
+        candidates = [name for name in signals if "scan" in name] or list(signals)
+        if not candidates:
+            sys.exit("no signals in %s" % path)
+        wanted = candidates[0]
+    if wanted not in signals:
+        sys.exit("signal %s not in %s (%s)" % (wanted, path, ", ".join(signals)))
+    ident = signals[wanted]
+
+    # value changes
+    edges = []
+    time = 0
+    for token in tokens:
+        if token.startswith("#"):
+            time = int(token[1:])
+        elif token[0] in "bB":
+            if next(tokens) == ident:
+                bits = token[1:].lower().replace("x", "0").replace("z", "0")
+                edges.append((time, int(bits, 2) != 0))
+        elif token[0] in "01xzXZ" and token[1:] == ident:
+            edges.append((time, token[0] == "1"))
+
+    return timescale, edges
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("vcd")
+    parser.add_argument("--signal", help="signal name, default the first one containing 'scan'")
+    parser.add_argument("--f-cpu", type=float, default=16e6)
+    parser.add_argument("--dump", type=int, default=0, help="print the last N period/duration pairs")
+    args = parser.parse_args()
+
+    timescale, edges = read_vcd(args.vcd, args.signal)
+    cycles = timescale * args.f_cpu
+
+    samples = []
+    rise = None
+    level = False
+    for time, high in edges:
+        if high and not level:
+            period = round((time - rise) * cycles) if rise is not None else None
+            rise = time
+            samples.append([period, None])
+        elif level and not high and samples:
+            samples[-1][1] = round((time - rise) * cycles)
+        level = high
+
+    periods = [period for period, _ in samples if period is not None]
+    durations = [duration for _, duration in samples if duration is not None]
+
+    if not periods:
+        print("scan n=0")
+        return
+
+    deviation = sum(period - NOMINAL for period in periods)
+    print("scan n=%d period min=%d avg=%d max=%d isr avg=%d max=%d" % (
+        len(periods), min(periods), NOMINAL + int(deviation / len(periods)), max(periods),
+        sum(durations) // len(durations) if durations else 0, max(durations) if durations else 0))
+
+    for period, duration in samples[-args.dump:] if args.dump else []:
+        print("%d %d" % (period or 0, duration or 0))
+
+
+if __name__ == "__main__":
+    main()